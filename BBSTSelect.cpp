@@ -13,312 +13,1988 @@
  * After initial insertion has completed, all further actions within the
  * tree occur in O(log(n)) time.
  *
+ * Usage: ./a.out [--tree] [--save <snapshot>] [--stats] [--binary int32|int64 <value_file>]
+ *        ./a.out --load <snapshot> [--verify]
+ *        ./a.out --stream [--backend <name>] [--domain <lo> <hi>] [<command_file>]
+ *        ./a.out --range [--backend wavelet|segment] [<query_file>]
+ *        ./a.out --window <N> <p1,p2,...> [<sample_file>]
+ *        ./a.out --sketch <epsilon> <p1,p2,...> [<sample_file>]
+ *        ./a.out --bench [<n>]
+ *        ./a.out --bench-balance [<n>]
+ *        ./a.out --bench-threads [<n>]
+ *        ./a.out --bench-suite [--sizes <n1,n2,...>] [--keys <streams>] [--backends <names>] [--samples <k>]
+ *
+ * Stream mode keeps a single tree alive and answers one command per line,
+ * read from the command file or stdin:
+ *   I x      Insert a copy of x (repeated values are all counted).
+ *   D x      Delete one copy of x.
+ *   S k      Print the k-th smallest value ("none" when out of range).
+ *   R x      Print the number of values <= x.
+ *   C lo hi  Print the number of values in [lo, hi].
+ *   A lo hi  Print the sum, min and max of the values in [lo, hi]
+ *            ("none" when empty). Aggregate backend only.
+ *   L i j    Print the values of ranks i..j on one line ("none" when empty).
+ *   K lo hi  Print the values in [lo, hi] on one line ("none" when empty).
+ *            L and K: avl and finger backends only.
+ *   T        Print the instrumentation counters as JSON (BBST_STATS builds).
+ *
+ * The backend is one of:
+ *   avl         The AVL tree (default).
+ *   treap       A randomized treap.
+ *   rbtree      A red-black tree.
+ *   wbtree      A weight-balanced tree.
+ *   bptree      A counted B+-tree with cache line sized nodes.
+ *   persistent  A persistent AVL tree whose versions can be read while it
+ *               is being updated.
+ *   concurrent  A B+-tree that many threads can update and query at once.
+ *   sharded     Key-range shards of AVL trees with a lock each, rebalanced
+ *               in the background.
+ *   lsm         A log-structured store: a sorted buffer flushed into sorted
+ *               runs that are merged in the background.
+ *   aggregate   The generic AugmentedTree keeping subtree sums, minima and maxima.
+ *   finger      The AVL tree with inserts that start from the previous insertion.
+ *   fenwick     A Fenwick tree over the bounded key domain given by --domain;
+ *               picked by default when the domain has at most 2^26 keys.
+ *               It allocates 4 bytes per key of the domain (256 MB at 2^26).
+ *
+ * --save also writes the tree to a snapshot file; --load maps a snapshot
+ * (no parsing or rebuilding) and answers the positions read from stdin.
+ * Loading checks only the snapshot's header; --verify also checks every node
+ * first, in time linear in the snapshot's size.
+ * --stats (in builds with -DBBST_STATS) prints the instrumentation counters
+ * and the tree's shape as JSON on stderr after the answers.
+ *
+ * Range mode reads a sequence on its first line, builds a wavelet matrix (or,
+ * with --backend segment, a persistent segment tree) over it and answers,
+ * per later line, "Q i j k" (the k-th smallest value among positions i..j)
+ * or "R i j x" (how many of them are <= x).
+ *
+ * Window mode reads a stream of integer samples and prints, after each one,
+ * the given percentiles (e.g. 50,99) of the last N samples. Sketch mode
+ * answers the percentiles of all samples both exactly and from a KLL sketch
+ * with rank error epsilon, and reports the sketch's error, time and memory.
+ *
+ * Bench mode times each backend on n random keys, batched select, the frozen
+ * Eytzinger index, iterator scans, the range indexes, the join-based merge
+ * of per-shard AVL trees, the sliding window and the KLL sketch;
+ * --bench-balance compares insert, select and erase, and the rotations
+ * per insert and erase, across the balancing schemes; --bench-threads measures how the concurrent and sharded indexes
+ * scale from 1 to 64 threads.
+ *
+ * --bench-suite is the regression benchmark: for every backend, on random,
+ * sorted and duplicate-heavy key streams of each size, it measures the bulk
+ * build and the throughput and latency percentiles of insert, erase, select
+ * and rank, and prints them as JSON. The default sizes are 10^3 to 10^6;
+ * larger ones, up to 10^9, are opt-in through --sizes (e.g. --sizes 1e9).
+ * A backend that does not apply to a stream (fenwick over a wide domain)
+ * gets a record marked "skipped".
+ *
+ * The indexes themselves live in headers under bbst/ (one per index
+ * family); this file holds the command-line drivers and benchmarks.
+ *
+ * Build: g++ -O2 -std=c++17 -pthread BBSTSelect.cpp
+ *        (add -DBBST_STATS for the instrumentation counters)
+ * Test:  g++ -O2 -std=c++17 -pthread BBSTSelectTest.cpp && ./a.out
+ *        (differential checks of every index against brute force)
+ *
+ */
+
+#include "bbst/avl.h"
+#include "bbst/balanced.h"
+#include "bbst/sharded.h"
+#include "bbst/lsm.h"
+#include "bbst/window.h"
+#include "bbst/snapshot.h"
+#include "bbst/fenwick.h"
+#include "bbst/frozen.h"
+#include "bbst/augmented.h"
+#include "bbst/bplus.h"
+#include "bbst/persistent.h"
+#include "bbst/concurrent.h"
+#include "bbst/sketch.h"
+#include "bbst/select.h"
+#include "bbst/range.h"
+#include "bbst/io.h"
+
+/**
+ * @brief Answers an L (ranks first..last) or K (keys in [first, last])
+ * command. Only the AVL based indexes can enumerate their values, which
+ * makes the commands malformed for the others.
+ *
+ * @return bool Whether the index supports the command.
+ */
+template <typename Tree>
+bool writeScan(OutputBuffer &, const Tree &, char, int, int)
+{
+    return false;
+}
+
+/**
+ * @brief Writes the scanned values on one line, separated by spaces, or "none".
+ */
+bool writeScan(OutputBuffer &out, Node *root, char command, int first, int last)
+{
+    bool any = false;
+    auto visit = [&](int value)
+    {
+        if (any)
+        {
+            out.writeChar(' ');
+        }
+        out.writeInt(value);
+        any = true;
+    };
+    if (command == 'L')
+    {
+        scanByRank(root, first, last, visit);
+    }
+    else
+    {
+        scanByKey(root, first, last, visit);
+    }
+    if (!any)
+    {
+        out.writeString("none");
+    }
+    out.writeChar('\n');
+    return true;
+}
+
+bool writeScan(OutputBuffer &out, const AVLTree &tree, char command, int first, int last)
+{
+    return writeScan(out, tree.getRoot(), command, first, last);
+}
+
+bool writeScan(OutputBuffer &out, const FingerTree &tree, char command, int first, int last)
+{
+    return writeScan(out, tree.getRoot(), command, first, last);
+}
+
+#ifdef BBST_STATS
+/**
+ * @brief Answers a T command: the instrumentation counters as JSON, with
+ * the shape of the tree for the AVL based indexes.
  */
+template <typename Tree>
+void writeStats(OutputBuffer &out, const Tree &)
+{
+    out.writeString(treeStatsJson().c_str());
+    out.writeChar('\n');
+}
 
-#include <iostream>
-#include <cstddef>
-#include <sstream>
-#include <vector>
+void writeStats(OutputBuffer &out, const AVLTree &tree)
+{
+    out.writeString(treeStatsJson(tree.getRoot()).c_str());
+    out.writeChar('\n');
+}
 
-using namespace std;
+void writeStats(OutputBuffer &out, const FingerTree &tree)
+{
+    out.writeString(treeStatsJson(tree.getRoot()).c_str());
+    out.writeChar('\n');
+}
+#endif
 
 /**
- * @brief Node structure.
+ * @brief Answers an A (range aggregate) command. Indexes without an
+ * aggregate cannot, which makes the command malformed for them.
  *
- * Contains additional features for height: to easily calculate the balance factor,
- * and the number of left and right children for each node: to assist with selection.
+ * @return bool Whether the index supports the command.
+ */
+template <typename Tree>
+bool writeRangeAggregate(OutputBuffer &, const Tree &, int, int)
+{
+    return false;
+}
+
+/**
+ * @brief Writes "sum min max" of the values in [low, high], or "none" for an empty range.
+ */
+template <typename Compare>
+bool writeRangeAggregate(OutputBuffer &out, const AugmentedTree<int, Compare, SumMinMaxAggregate<int>> &tree,
+                         int low, int high)
+{
+    if (tree.countRange(low, high) == 0)
+    {
+        out.writeString("none\n");
+        return true;
+    }
+    SumMinMaxAggregate<int>::value_type result = tree.aggregateRange(low, high);
+    out.writeInt(result.sum);
+    out.writeChar(' ');
+    out.writeInt(result.min);
+    out.writeChar(' ');
+    out.writeInt(result.max);
+    out.writeChar('\n');
+    return true;
+}
+
+/**
+ * @brief Stream mode driver. Applies every command of the stream to one
+ * long-lived tree and writes one line per query (S, R, C, A, L, K).
+ * Malformed lines are reported on stderr and skipped.
  *
+ * @param input The command stream.
+ * @param output Where the answers are written.
+ * @param tree The order-statistic index the commands are applied to.
+ * @return int The number of malformed commands.
  */
-class Node
+template <typename Tree>
+int runStream(FILE *input, FILE *output, Tree &tree)
 {
-public:
-    int value;
-    Node *left;
-    Node *right;
-    int height;
-    int numLeftChildren, numRightChildren;
-};
+    InputScanner scanner(input);
+    OutputBuffer out(output);
+    int errors = 0;
+    int command;
+
+    while ((command = scanner.next()) != EOF)
+    {
+        int first, second, value;
+        bool ok = scanner.readInt(first);
+
+        switch (command)
+        {
+        case 'I':
+            if (ok)
+            {
+                tree.insert(first);
+            }
+            break;
+        case 'D':
+            if (ok)
+            {
+                tree.erase(first);
+            }
+            break;
+        case 'S':
+            if (ok)
+            {
+                if (tree.select(first, value))
+                {
+                    out.writeInt(value);
+                }
+                else
+                {
+                    out.writeString("none");
+                }
+                out.writeChar('\n');
+            }
+            break;
+        case 'R':
+            if (ok)
+            {
+                out.writeInt(tree.getRank(first));
+                out.writeChar('\n');
+            }
+            break;
+        case 'C':
+            ok = ok && scanner.readInt(second);
+            if (ok)
+            {
+                out.writeInt(tree.countRange(first, second));
+                out.writeChar('\n');
+            }
+            break;
+        case 'A':
+            ok = ok && scanner.readInt(second) && writeRangeAggregate(out, tree, first, second);
+            break;
+        case 'L':
+        case 'K':
+            ok = ok && scanner.readInt(second) && writeScan(out, tree, (char)command, first, second);
+            break;
+#ifdef BBST_STATS
+        case 'T':
+            writeStats(out, tree);
+            ok = true;
+            break;
+#endif
+        default:
+            ok = false;
+        }
+
+        if (!ok)
+        {
+            out.flush();
+            fprintf(stderr, "Skipping malformed command '%c'\n", command);
+            scanner.skipLine();
+            errors++;
+        }
+    }
+
+    return errors;
+}
 
 /**
- * @brief Return the height of a given node.
+ * @brief Window mode driver. Reads whitespace separated samples and, after
+ * each one, writes the configured percentiles of the last N samples on one
+ * line, separated by spaces. Malformed tokens are reported on stderr and skipped.
  *
- * @param node A node.
- * @return int The height of the node.
+ * @param input The samples.
+ * @param output Where the percentiles are written.
+ * @param capacity N, the window length.
+ * @param percentiles The percentiles to report, each in [0, 100].
+ * @return int The number of malformed tokens.
  */
-int height(Node *node)
+int runWindow(FILE *input, FILE *output, int capacity, const vector<double> &percentiles)
 {
-    if (node == NULL)
+    InputScanner scanner(input);
+    OutputBuffer out(output);
+    SlidingWindow window(capacity);
+    int errors = 0;
+
+    while (scanner.peek() != EOF)
     {
-        return 0;
+        int sample;
+        if (!scanner.readInt(sample))
+        {
+            out.flush();
+            reportMalformed(scanner, "sample");
+            errors++;
+            continue;
+        }
+
+        window.push(sample);
+        for (size_t i = 0; i < percentiles.size(); i++)
+        {
+            int value = 0;
+            window.percentile(percentiles[i], value);
+            if (i > 0)
+            {
+                out.writeChar(' ');
+            }
+            out.writeInt(value);
+        }
+        out.writeChar('\n');
     }
-    return node->height;
+
+    return errors;
 }
 
 /**
- * @brief Creates a new node and initializes its
- * parameter. Public visibility for simplicity.
+ * @brief Parses a comma separated percentile list such as "50,99,99.9".
  *
- * @param value
- * @return Node*
+ * @param text The list.
+ * @param percentiles Receives the percentiles.
+ * @return bool False unless every entry is a number in [0, 100].
  */
-Node *newNode(int value)
+bool parsePercentiles(const char *text, vector<double> &percentiles)
 {
-    Node *node = new Node();
-    node->value = value;
-    node->left = NULL;
-    node->right = NULL;
-    node->height = 1;
-    node->numLeftChildren = 0;
-    node->numRightChildren = 0;
-    return (node);
+    while (*text != '\0')
+    {
+        char *end;
+        double percentile = strtod(text, &end);
+        if (end == text || percentile < 0 || percentile > 100 || (*end != ',' && *end != '\0'))
+        {
+            return false;
+        }
+        percentiles.push_back(percentile);
+        text = *end == ',' ? end + 1 : end;
+    }
+    return !percentiles.empty();
 }
 
 /**
- * @brief Right rotation.
- * 1. Store inital pointers.
- * 2. Connect the pivot as the left child for the new parent.
- * 3. Connect the new parent's left child as the pivot's right child.
- * 4. Update the number of children for each node involved in the rotation.
- * 5. Update the height of the nodes involved for further balance tests.
+ * @brief Sketch mode driver. Reads every sample, then feeds them to an exact
+ * AVL tree and to a KLL sketch, and reports each percentile from both with
+ * the sketch's rank error, followed by the build times and memory of each.
  *
- * @param pivotNode The unbalanced node about which the rotation will occur.
- * @return Node* The new parent node AFTER the rotation. To be connected back into the tree.
+ * @param input The samples.
+ * @param epsilon The sketch's rank error bound, as a fraction of n.
+ * @param percentiles The percentiles to report, each in [0, 100].
+ * @return int The number of malformed tokens.
  */
-Node *rightRotate(Node *pivotNode)
+int runSketch(FILE *input, double epsilon, const vector<double> &percentiles)
 {
-    Node *newPivot = pivotNode->left;
-    Node *newPivotRightChild = newPivot->right;
+    InputScanner scanner(input);
+    vector<int> samples;
+    int errors = 0;
+    while (scanner.peek() != EOF)
+    {
+        int sample;
+        if (scanner.readInt(sample))
+        {
+            samples.push_back(sample);
+        }
+        else
+        {
+            reportMalformed(scanner, "sample");
+            errors++;
+        }
+    }
+    if (samples.empty())
+    {
+        printf("no samples\n");
+        return errors;
+    }
+
+    auto start = chrono::steady_clock::now();
+    AVLTree tree;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        tree.insert(samples[i]);
+    }
+    auto treeBuilt = chrono::steady_clock::now();
+    KLLSketch sketch(epsilon);
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        sketch.insert(samples[i]);
+    }
+    auto sketchBuilt = chrono::steady_clock::now();
+
+    long long n = (long long)samples.size();
+    for (size_t i = 0; i < percentiles.size(); i++)
+    {
+        long long position = nearestRank(percentiles[i], n);
+        int exact = 0, approximate = 0;
+        tree.select((int)position, exact);
+        sketch.select(position, approximate);
+        // How far the approximate answer's rank range is from the target position.
+        long long rankLow = tree.countLess(approximate) + 1, rankHigh = tree.getRank(approximate);
+        long long rankError = position < rankLow ? rankLow - position : position > rankHigh ? position - rankHigh : 0;
+        printf("p%g exact %d approx %d rank error %.5f\n", percentiles[i], exact, approximate,
+               (double)rankError / n);
+    }
 
-    // Perform rotation
-    newPivot->right = pivotNode;
-    pivotNode->left = newPivotRightChild;
+    auto millis = [](chrono::steady_clock::duration d)
+    { return chrono::duration<double, milli>(d).count(); };
+    printf("exact: %.1f ms, %lld values, %lld bytes of nodes\n", millis(treeBuilt - start), n,
+           countNodes(tree.getRoot()) * (long long)sizeof(Node));
+    printf("sketch (epsilon %g): %.1f ms, %d items retained, %d bytes\n", epsilon,
+           millis(sketchBuilt - treeBuilt), sketch.itemsRetained(), (int)(sketch.itemsRetained() * sizeof(int)));
+    return errors;
+}
 
-    // Store necessary details of intial config.
-    int beginPivotLeftChildren = pivotNode->numLeftChildren;
-    int beginNewPivotRightChildren = newPivot->numRightChildren;
-    // Redetermine old pivot nodes new num of children.
-    pivotNode->numLeftChildren = beginNewPivotRightChildren;
-    newPivot->numRightChildren = pivotNode->numLeftChildren + pivotNode->numRightChildren + 1;
+/**
+ * @brief Range mode driver. The first line holds the sequence; every later
+ * line is a query over its positions i..j (1-based, inclusive):
+ *   Q i j k  Print the k-th smallest value among positions i..j ("none"
+ *            when the range or k is out of bounds).
+ *   R i j x  Print the number of values <= x among positions i..j.
+ * Malformed lines are reported on stderr and skipped.
+ *
+ * @param input The sequence and the queries.
+ * @param output Where the answers are written.
+ * @param index Built from the sequence; answers rangeQuantile() and rangeRank().
+ * @return int The number of malformed queries.
+ */
+template <typename RangeIndex>
+int runRange(FILE *input, FILE *output, RangeIndex &index)
+{
+    InputScanner scanner(input);
+    OutputBuffer out(output);
+    vector<int> sequence;
+    int value;
+    while (scanner.readInt(value))
+    {
+        sequence.push_back(value);
+    }
+    scanner.skipLine();
+    index.build(sequence);
 
-    // Recalculate heights
-    pivotNode->height = max(height(pivotNode->left), height(pivotNode->right)) + 1;
-    newPivot->height = max(height(newPivot->left), height(newPivot->right)) + 1;
+    int errors = 0;
+    int command;
+    while ((command = scanner.next()) != EOF)
+    {
+        int first, last, argument;
+        bool ok = scanner.readInt(first) && scanner.readInt(last) && scanner.readInt(argument);
+        // Clamp to the sequence; an empty or inverted range has no values.
+        size_t left = (size_t)max(first - 1, 0);
+        size_t right = (size_t)max(min(last, (int)sequence.size()), 0);
 
-    // Return new root
-    return newPivot;
+        if (ok && command == 'Q')
+        {
+            if (left < right && index.rangeQuantile(left, right, (size_t)max(argument, 0), value))
+            {
+                out.writeInt(value);
+            }
+            else
+            {
+                out.writeString("none");
+            }
+            out.writeChar('\n');
+        }
+        else if (ok && command == 'R')
+        {
+            out.writeInt(left < right ? (long long)index.rangeRank(left, right, argument) : 0);
+            out.writeChar('\n');
+        }
+        else
+        {
+            out.flush();
+            fprintf(stderr, "Skipping malformed query '%c'\n", command);
+            scanner.skipLine();
+            errors++;
+        }
+    }
+    return errors;
 }
 
 /**
- * @brief Left rotation.
- * 1. Store inital pointers.
- * 2. Connect the pivot as the right child for the new parent.
- * 3. Connect the new parent's right child as the pivot's left child.
- * 4. Update the number of children for each node involved in the rotation.
- * 5. Update the height of the nodes involved for further balance tests.
+ * @brief Times bulk build, select and rank on one index over the same keys.
  *
- * @param pivotNode The unbalanced node about which the rotation will occur.
- * @return Node* The new parent node AFTER the rotation. To be connected back into the tree.
+ * @param name The label printed for this index.
+ * @param tree The index, empty.
+ * @param keys The keys to insert, in insertion order.
+ * @param queries The number of select and rank queries to time.
  */
-Node *leftRotate(Node *pivotNode)
+template <typename Tree>
+void benchmarkIndex(const char *name, Tree &tree, const vector<int> &keys, int queries)
 {
-    Node *newPivot = pivotNode->right;
-    Node *leftChildOfNewPivot = newPivot->left;
+    mt19937 generator(12345);
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        tree.insert(keys[i]);
+    }
+    auto built = chrono::steady_clock::now();
 
-    // Perform rotation
-    newPivot->left = pivotNode;
-    pivotNode->right = leftChildOfNewPivot;
+    // Accumulate the answers so the lookups cannot be optimized away.
+    long long checksum = 0;
+    int n = tree.size();
+    uniform_int_distribution<int> positions(1, max(n, 1));
+    for (int i = 0; i < queries; i++)
+    {
+        int value = 0;
+        tree.select(positions(generator), value);
+        checksum += value;
+    }
+    auto selected = chrono::steady_clock::now();
 
-    // Store necessary details of intial config.
-    int beginPivotRightChildren = pivotNode->numRightChildren;
-    int beginNewPivotLeftChildren = newPivot->numLeftChildren;
-    // Redetermine old pivot nodes new num of children.
-    pivotNode->numRightChildren = beginNewPivotLeftChildren;
-    newPivot->numLeftChildren = pivotNode->numLeftChildren + pivotNode->numRightChildren + 1;
+    for (int i = 0; i < queries; i++)
+    {
+        checksum += tree.getRank(keys[generator() % keys.size()]);
+    }
+    auto ranked = chrono::steady_clock::now();
 
-    // Redetermine the node heights
-    pivotNode->height = max(height(pivotNode->left), height(pivotNode->right)) + 1;
-    newPivot->height = max(height(newPivot->left), height(newPivot->right)) + 1;
+    auto nanos = [](chrono::steady_clock::duration d)
+    { return (double)chrono::duration_cast<chrono::nanoseconds>(d).count(); };
+    printf("%-8s n=%-10d build %9.1f ms  select %7.1f ns/op  rank %7.1f ns/op  (checksum %lld)\n",
+           name, n, nanos(built - start) / 1e6, nanos(selected - built) / queries,
+           nanos(ranked - selected) / queries, checksum);
+}
 
-    // Return new root to connect to parent
-    return newPivot;
+/**
+ * @brief benchmarkIndex() on a default constructed, empty index.
+ */
+template <typename Tree>
+void benchmarkIndex(const char *name, const vector<int> &keys, int queries)
+{
+    Tree tree;
+    benchmarkIndex(name, tree, keys, queries);
 }
 
 /**
- * @brief Get the balance factor of a given node.
+ * @brief Times combining per-shard AVL trees: re-inserting every value one
+ * by one against the join-based union, plus a sorted bulk insert.
  *
- * @param node The node to calculate the balance factor.
- * @return int The balance factor.
+ * @param keys The keys, dealt round-robin to the shards.
  */
-int getBalance(Node *node)
+void benchmarkBulk(const vector<int> &keys)
 {
-    if (node == NULL)
+    const int shards = 8;
+    auto millis = [](chrono::steady_clock::duration d)
+    { return chrono::duration<double, milli>(d).count(); };
+
+    vector<AVLTree> naiveShards(shards), unionShards(shards);
+    for (size_t i = 0; i < keys.size(); i++)
     {
-        return 0;
+        naiveShards[i % shards].insert(keys[i]);
+        unionShards[i % shards].insert(keys[i]);
+    }
+
+    auto start = chrono::steady_clock::now();
+    AVLTree naive;
+    for (int s = 0; s < shards; s++)
+    {
+        for (int k = 1; k <= naiveShards[s].size(); k++)
+        {
+            int value = 0;
+            naiveShards[s].select(k, value);
+            naive.insert(value);
+        }
     }
-    return height(node->left) - height(node->right);
+    auto reinserted = chrono::steady_clock::now();
+
+    // Pairwise tree reduction, so every union combines trees of similar size.
+    for (int width = 1; width < shards; width *= 2)
+    {
+        for (int s = 0; s + width < shards; s += 2 * width)
+        {
+            unionShards[s].unionWith(unionShards[s + width]);
+        }
+    }
+    auto unioned = chrono::steady_clock::now();
+
+    vector<int> sorted(keys);
+    sort(sorted.begin(), sorted.end());
+    auto sortedAt = chrono::steady_clock::now();
+    AVLTree bulk;
+    bulk.insertSorted(sorted);
+    auto bulkBuilt = chrono::steady_clock::now();
+
+    printf("merge %d shards: re-insert %.1f ms, union %.1f ms (sizes %d/%d); sorted bulk insert %.1f ms\n",
+           shards, millis(reinserted - start), millis(unioned - reinserted), naive.size(),
+           unionShards[0].size(), millis(bulkBuilt - sortedAt));
 }
 
 /**
- * @brief Inserts a new node into the Balanced Binary Search Tree.
- * 1. If no root: Insert the new node as the root.
- * 2. Determine if the value of the new node is greater than or less than that
- * of the currently in place node. Move down the tree accordingly.
- * 3. Insert the node as a leaf node (where the are no nodes currently).
- * 4. Determine the balance factor for the BBST after the insertion.
- * 4. Perform rotations upon unbalanced nodes as needed.
+ * @brief Times select on the AVL tree one query at a time against
+ * selectBatch(), on the same random positions.
  *
- * @param node Initially, the root of the BBST. Recursion will update this
- *             parameter throughout the function's life cycle.
- * @param value The value of the new node.
- * @return Node* Each recursion will return the current node it is on.
- * Ultimately, the root node will be returned.
+ * @param keys The keys to insert.
+ * @param queries The number of select queries to time.
  */
-Node *insert(Node *node, int value)
+void benchmarkBatch(const vector<int> &keys, int queries)
 {
-    // If no root supplied, add the node as the root.
-    // OR
-    // Add the node as a leaf node.
-    if (node == NULL)
+    AVLTree tree;
+    for (size_t i = 0; i < keys.size(); i++)
     {
-        return (newNode(value));
+        tree.insert(keys[i]);
     }
-    // Is the node gt or lt the current node?
-    // Insert the node as a leaf.
-    // Build the number of children each node has as
-    // derived from insertions.
-    if (value < node->value)
+    mt19937 generator(99);
+    uniform_int_distribution<int> distribution(1, max(tree.size(), 1));
+    vector<int> positions(queries);
+    for (int i = 0; i < queries; i++)
     {
-        node->numLeftChildren += 1;
-        node->left = insert(node->left, value);
+        positions[i] = distribution(generator);
     }
-    else if (value > node->value)
+
+    long long checksum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < queries; i++)
     {
-        node->numRightChildren += 1;
-        node->right = insert(node->right, value);
+        int value = 0;
+        tree.select(positions[i], value);
+        checksum += value;
     }
-    // No duplicates
-    else
+    auto single = chrono::steady_clock::now();
+    vector<Node *> found(queries);
+    selectBatch(positions.data(), queries, tree.getRoot(), found.data());
+    for (int i = 0; i < queries; i++)
     {
-        return node;
+        checksum -= found[i]->value;
     }
+    auto batched = chrono::steady_clock::now();
 
-    // Calculate the height of the node.
-    node->height = max(height(node->left), height(node->right)) + 1;
+    auto nanos = [](chrono::steady_clock::duration d)
+    { return (double)chrono::duration_cast<chrono::nanoseconds>(d).count(); };
+    printf("select one at a time %.1f ns/op, batched by %d %.1f ns/op (difference %lld)\n",
+           nanos(single - start) / queries, SELECT_GROUP, nanos(batched - single) / queries, checksum);
+}
 
-    // Check the balance of the node.
-    int balance = getBalance(node);
+/**
+ * @brief Times select and rank on the pointer-based AVL tree against the
+ * same tree frozen into a FrozenIndex, on the same random queries.
+ *
+ * @param keys The keys to insert.
+ * @param queries The number of queries of each kind.
+ */
+void benchmarkFrozen(const vector<int> &keys, int queries)
+{
+    AVLTree tree;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        tree.insert(keys[i]);
+    }
+    auto start = chrono::steady_clock::now();
+    FrozenIndex frozen;
+    frozen.freeze(tree.getRoot());
+    auto frozenAt = chrono::steady_clock::now();
 
-    // Left Left Rotation
-    if (balance > 1 && value < node->left->value)
+    mt19937 generator(77);
+    uniform_int_distribution<int> distribution(1, max(tree.size(), 1));
+    vector<int> positions(queries), probes(queries);
+    for (int i = 0; i < queries; i++)
     {
-        return rightRotate(node);
+        positions[i] = distribution(generator);
+        probes[i] = keys[generator() % keys.size()];
     }
 
-    // Right Right Rotation
-    if (balance < -1 && value > node->right->value)
+    // Each lookup is timed over the whole query set; the checksums must agree.
+    long long pointerSum = 0, frozenSum = 0;
+    auto timeQueries = [&](auto lookup, long long &checksum)
+    {
+        auto begin = chrono::steady_clock::now();
+        for (int i = 0; i < queries; i++)
+        {
+            checksum += lookup(i);
+        }
+        return (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count() /
+               queries;
+    };
+    double pointerSelect = timeQueries([&](int i)
+                                       { int value = 0; tree.select(positions[i], value); return value; },
+                                       pointerSum);
+    double frozenSelect = timeQueries([&](int i)
+                                      { int value = 0; frozen.select(positions[i], value); return value; },
+                                      frozenSum);
+    double pointerRank = timeQueries([&](int i)
+                                     { return tree.getRank(probes[i]); }, pointerSum);
+    double frozenRank = timeQueries([&](int i)
+                                    { return frozen.getRank(probes[i]); }, frozenSum);
+
+    printf("frozen (freeze %.1f ms): select %.1f vs %.1f ns/op, rank %.1f vs %.1f ns/op pointer vs frozen%s\n",
+           chrono::duration<double, milli>(frozenAt - start).count(), pointerSelect, frozenSelect, pointerRank,
+           frozenRank, pointerSum == frozenSum ? "" : " (MISMATCH)");
+}
+
+/**
+ * @brief Times building a range order-statistic index over a sequence and
+ * answering range k-th queries on it.
+ *
+ * @param name The label printed for this index.
+ * @param keys The sequence.
+ * @param queries The number of range k-th queries to time.
+ */
+template <typename RangeIndex>
+void benchmarkRange(const char *name, const vector<int> &keys, int queries)
+{
+    mt19937 generator(12345);
+    auto start = chrono::steady_clock::now();
+    RangeIndex index;
+    index.build(keys);
+    auto built = chrono::steady_clock::now();
+
+    long long checksum = 0;
+    size_t n = keys.size();
+    for (int q = 0; q < queries && n > 0; q++)
     {
-        return leftRotate(node);
+        size_t left = generator() % n, right = generator() % n;
+        if (left > right)
+        {
+            swap(left, right);
+        }
+        right++;
+        int value = 0;
+        index.rangeQuantile(left, right, 1 + generator() % (right - left), value);
+        checksum += value;
     }
+    auto queried = chrono::steady_clock::now();
+
+    printf("range %-8s build %9.1f ms  k-th %7.1f ns/op  (checksum %lld)\n", name,
+           chrono::duration<double, milli>(built - start).count(),
+           (double)chrono::duration_cast<chrono::nanoseconds>(queried - built).count() / max(queries, 1), checksum);
+}
 
-    // Left Right Rotation
-    if (balance > 1 && value > node->left->value)
+/**
+ * @brief Times exporting every value in order: a select per rank against one
+ * iterator scan.
+ *
+ * @param keys The keys to insert.
+ */
+void benchmarkScan(const vector<int> &keys)
+{
+    AVLTree tree;
+    for (size_t i = 0; i < keys.size(); i++)
     {
-        node->left = leftRotate(node->left);
-        return rightRotate(node);
+        tree.insert(keys[i]);
     }
+    int n = tree.size();
+    long long checksum = 0;
 
-    // Right Left Rotation
-    if (balance < -1 && value < node->right->value)
+    auto start = chrono::steady_clock::now();
+    for (int k = 1; k <= n; k++)
     {
-        node->right = rightRotate(node->right);
-        return leftRotate(node);
+        int value = 0;
+        tree.select(k, value);
+        checksum += value;
     }
+    auto selected = chrono::steady_clock::now();
+    tree.scanByRank(1, n, [&checksum](int value)
+                    { checksum -= value; });
+    auto scanned = chrono::steady_clock::now();
 
-    return node;
+    auto nanos = [n](chrono::steady_clock::duration d)
+    { return (double)chrono::duration_cast<chrono::nanoseconds>(d).count() / max(n, 1); };
+    printf("in-order export: select per rank %.1f ns/value, iterator scan %.1f ns/value (difference %lld)\n",
+           nanos(selected - start), nanos(scanned - selected), checksum);
 }
 
 /**
- * @brief Takes a user requested selection statistic,
- * i.e., 12 representing the 12th lowest item in the BBST,
- * and returns a reference to the Node at that location.
+ * @brief Times the sliding window on a stream of keys: one push and a p50
+ * and p99 query per sample.
  *
- * @param position The position of the desired node.
- * @param root The root node of the BBST.
- * @return Node* The desired node.
+ * @param keys The samples.
+ * @param capacity The window length.
  */
-Node *select(int position, Node *root)
+void benchmarkWindow(const vector<int> &keys, int capacity)
 {
-    if (root != NULL)
+    SlidingWindow window(capacity);
+    long long checksum = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++)
     {
-        Node *currNode = root;
+        int p50 = 0, p99 = 0;
+        window.push(keys[i]);
+        window.percentile(50, p50);
+        window.percentile(99, p99);
+        checksum += p50 + p99;
+    }
+    auto finished = chrono::steady_clock::now();
 
-        while (true)
-        {
-            // What is the current node's position?
-            int myPosition = currNode->numLeftChildren + 1;
-            // Is the desired position gt, lt, or equal to the current node's position?
-            if (position > myPosition)
-            {
-                // Update the requested position to be equiv. to the desired position
-                // considering only the right subtree portions of the BBST.
-                position -= myPosition;
-                // Move right
-                currNode = currNode->right;
-            }
-            else if (position < myPosition)
-            {
-                // Move left - no need to update position
-                currNode = currNode->left;
-            }
-            // Match condition
-            else
-            {
-                return currNode;
-            }
-        }
+    double seconds = chrono::duration<double>(finished - start).count();
+    printf("window N=%d: %.2f M samples/s with p50+p99 per sample (checksum %lld)\n",
+           capacity, keys.size() / seconds / 1e6, checksum);
+}
+
+/**
+ * @brief Times the KLL sketch against the exact tree: per-shard sketches are
+ * built and merged, then the worst rank error over the percentiles 1..99 is
+ * measured against the sorted keys.
+ *
+ * @param keys The samples, dealt round-robin to the shards.
+ * @param epsilon The sketch's error bound.
+ */
+void benchmarkSketch(const vector<int> &keys, double epsilon)
+{
+    const int shards = 8;
+    auto start = chrono::steady_clock::now();
+    vector<KLLSketch> sketches(shards, KLLSketch(epsilon));
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        sketches[i % shards].insert(keys[i]);
+    }
+    for (int s = 1; s < shards; s++)
+    {
+        sketches[0].merge(sketches[s]);
+    }
+    auto built = chrono::steady_clock::now();
+
+    vector<int> sorted(keys);
+    sort(sorted.begin(), sorted.end());
+    long long n = (long long)sorted.size(), worst = 0;
+    for (int p = 1; p <= 99; p++)
+    {
+        long long position = nearestRank(p, n);
+        int value = 0;
+        sketches[0].select(position, value);
+        long long rankLow = lower_bound(sorted.begin(), sorted.end(), value) - sorted.begin() + 1;
+        long long rankHigh = upper_bound(sorted.begin(), sorted.end(), value) - sorted.begin();
+        worst = max(worst, position < rankLow ? rankLow - position : position > rankHigh ? position - rankHigh : 0);
     }
-    // No BBST exists
-    return NULL;
+
+    printf("kll epsilon=%g: %d shards built and merged in %.1f ms, %d items, worst rank error %.5f\n", epsilon,
+           shards, chrono::duration<double, milli>(built - start).count(), sketches[0].itemsRetained(),
+           (double)worst / max(n, 1LL));
 }
 
 /**
- * @brief Program driver. Takes input from the command line.
- * 1st line = all space seperated node values to be inserted into the BBST.
- * 2nd line = a single integer representing the ordering statistic to be used
- *            in the select function.
+ * @brief Compares the order-statistic indexes on n random keys.
  *
- * @return int A success status code of 0.
+ * @param n The number of keys.
  */
-int main()
+void runBenchmark(int n)
 {
-    vector<int> inputNodes;
-    string inputString, selectStatistic;
+    mt19937 generator(42);
+    vector<int> keys(n);
+    for (int i = 0; i < n; i++)
+    {
+        keys[i] = (int)(generator() >> 1);
+    }
 
-    // Create our root node for reference.
-    Node *root = NULL;
+    int queries = max(n, 100000);
+    benchmarkIndex<AVLTree>("avl", keys, queries);
+    benchmarkIndex<BPlusTree>("bptree", keys, queries);
+    benchmarkIndex<PersistentTree>("persist", keys, queries);
+    benchmarkIndex<AugmentedTree<int>>("generic", keys, queries);
+    benchmarkIndex<AugmentedTree<int, less<int>, SumMinMaxAggregate<int>>>("aggr", keys, queries);
+    benchmarkIndex<LSMStore>("lsm", keys, queries);
 
-    // Get the 1st line of input from the command line.
-    getline(cin, inputString);
+    // Mostly increasing keys (timestamps with a little jitter).
+    vector<int> timestamps(n);
+    for (int i = 0; i < n; i++)
+    {
+        timestamps[i] = 4 * i + (int)(generator() % 8);
+    }
+    benchmarkIndex<AVLTree>("avl-seq", timestamps, queries);
+    benchmarkIndex<FingerTree>("finger", timestamps, queries);
 
-    stringstream ss(inputString);
-    string node;
-    // Create a vector from our space-delimited input string
-    while (getline(ss, node, ' '))
+    // Bounded domain: latencies in microseconds up to 10^7.
+    vector<int> latencies(n);
+    for (int i = 0; i < n; i++)
     {
-        inputNodes.push_back(stoi(node));
+        latencies[i] = keys[i] % 10000000;
     }
+    benchmarkIndex<AVLTree>("avl-10^7", latencies, queries);
+    FenwickIndex fenwick(0, 10000000 - 1);
+    benchmarkIndex("fenwick", fenwick, latencies, queries);
 
-    // Get the 2nd line of input from the command line.
-    getline(cin, selectStatistic);
+    benchmarkBatch(keys, queries);
+    benchmarkFrozen(keys, queries);
+    benchmarkScan(keys);
+    benchmarkRange<WaveletMatrix>("wavelet", keys, queries);
+    benchmarkRange<PersistentSegmentTree>("segment", keys, queries);
+    benchmarkBulk(keys);
+    benchmarkWindow(keys, 1000);
+    benchmarkSketch(keys, 0.01);
+}
 
-    // Create our BBST.
-    for (int i = 0; i < inputNodes.size(); i++)
+/**
+ * @brief Wraps an index in one global lock, the baseline for the thread benchmark.
+ */
+template <typename Tree>
+class LockedIndex
+{
+public:
+    void insert(int value)
     {
-        root = insert(root, inputNodes.at(i));
+        lock_guard<mutex> guard(lock);
+        tree.insert(value);
+    }
+    void erase(int value)
+    {
+        lock_guard<mutex> guard(lock);
+        tree.erase(value);
+    }
+    bool select(int position, int &value)
+    {
+        lock_guard<mutex> guard(lock);
+        return tree.select(position, value);
+    }
+    int size()
+    {
+        lock_guard<mutex> guard(lock);
+        return tree.size();
+    }
+
+private:
+    mutex lock;
+    Tree tree;
+};
+
+/**
+ * @brief Runs a mixed workload (50% insert, 10% erase, 40% select) split
+ * over a number of threads against one shared index.
+ *
+ * @return double Throughput in millions of operations per second.
+ */
+template <typename Index>
+double measureThreads(int n, int threads)
+{
+    Index index;
+    mt19937 prefill(7);
+    for (int i = 0; i < n / 2; i++)
+    {
+        index.insert((int)(prefill() >> 1));
     }
 
-    // Find and print the desired node by the given ordering statistic. i.e., 5th lowest value.
-    cout << select(stoi(selectStatistic), root)->value << endl;
+    int opsPerThread = n / threads;
+    vector<thread> workers;
+    atomic<long long> checksum(0);
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&index, &checksum, opsPerThread, n, t]()
+                             {
+            mt19937 generator(1000 + t);
+            long long local = 0;
+            for (int i = 0; i < opsPerThread; i++)
+            {
+                unsigned roll = generator() % 10;
+                int key = (int)(generator() >> 1);
+                if (roll < 5)
+                {
+                    index.insert(key);
+                }
+                else if (roll < 6)
+                {
+                    index.erase(key);
+                }
+                else
+                {
+                    int value = 0;
+                    index.select(1 + key % (n / 2), value);
+                    local += value;
+                }
+            }
+            checksum += local; });
+    }
+    for (size_t t = 0; t < workers.size(); t++)
+    {
+        workers[t].join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return (double)opsPerThread * threads / seconds / 1e6;
+}
+
+/**
+ * @brief The rotations a tree has made so far, or -1 when it does not count
+ * them: the AVL rotations are only counted in BBST_STATS builds.
+ */
+inline long long rotationsSoFar(const RankedTreeBase &tree)
+{
+    return (long long)tree.rotationCount();
+}
+
+inline long long rotationsSoFar(const AVLTree &)
+{
+#ifdef BBST_STATS
+    return (long long)(treeStats.leftRotations + treeStats.rightRotations);
+#else
+    return -1;
+#endif
+}
+
+/**
+ * @brief Times one balancing scheme on one workload: inserting every key,
+ * selecting random positions, then erasing every key in a shuffled order.
+ * The rotations per insert and per erase are printed next to the times.
+ *
+ * @param name The label printed for this tree.
+ * @param keys The keys, in insertion order.
+ */
+template <typename Tree>
+void benchmarkBalance(const char *name, const vector<int> &keys)
+{
+    int n = (int)keys.size();
+    vector<int> erasures(keys);
+    mt19937 generator(31);
+    shuffle(erasures.begin(), erasures.end(), generator);
+    uniform_int_distribution<int> positions(1, max(n, 1));
+    Tree tree;
+    long long checksum = 0;
+
+    long long rotationsBefore = rotationsSoFar(tree);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++)
+    {
+        tree.insert(keys[i]);
+    }
+    auto inserted = chrono::steady_clock::now();
+    long long insertRotations = rotationsBefore < 0 ? -1 : rotationsSoFar(tree) - rotationsBefore;
+    for (int i = 0; i < n; i++)
+    {
+        int value = 0;
+        tree.select(positions(generator), value);
+        checksum += value;
+    }
+    auto selected = chrono::steady_clock::now();
+    long long eraseBefore = rotationsSoFar(tree);
+    for (int i = 0; i < n; i++)
+    {
+        tree.erase(erasures[i]);
+    }
+    auto erased = chrono::steady_clock::now();
+    long long eraseRotations = eraseBefore < 0 ? -1 : rotationsSoFar(tree) - eraseBefore;
+
+    auto nanos = [n](chrono::steady_clock::duration d)
+    { return (double)chrono::duration_cast<chrono::nanoseconds>(d).count() / max(n, 1); };
+    // Per operation, or "-" for a tree that does not count its rotations.
+    auto perOperation = [n](long long rotations)
+    {
+        char text[32] = "-";
+        if (rotations >= 0)
+        {
+            snprintf(text, sizeof(text), "%.3f", (double)rotations / max(n, 1));
+        }
+        return string(text);
+    };
+    printf("  %-8s insert %7.1f  select %7.1f  erase %7.1f ns/op  rotations/op insert %-5s erase %-5s"
+           "  (checksum %lld, left %d)\n",
+           name, nanos(inserted - start), nanos(selected - inserted), nanos(erased - selected),
+           perOperation(insertRotations).c_str(), perOperation(eraseRotations).c_str(), checksum, tree.size());
+}
+
+/**
+ * @brief Compares the balancing schemes (AVL, treap, red-black,
+ * weight-balanced) on random, increasing and duplicate-heavy keys.
+ *
+ * @param n The number of keys per workload.
+ */
+void runBalanceBenchmark(int n)
+{
+    mt19937 generator(8);
+    vector<int> random(n), increasing(n), duplicates(n);
+    for (int i = 0; i < n; i++)
+    {
+        random[i] = (int)(generator() >> 1);
+        increasing[i] = i;
+        duplicates[i] = (int)(generator() % 1000);
+    }
+
+    const char *names[] = {"random", "increasing", "duplicate-heavy"};
+    const vector<int> *workloads[] = {&random, &increasing, &duplicates};
+    for (int w = 0; w < 3; w++)
+    {
+        printf("%s keys, n=%d\n", names[w], n);
+        benchmarkBalance<AVLTree>("avl", *workloads[w]);
+        benchmarkBalance<TreapTree>("treap", *workloads[w]);
+        benchmarkBalance<RedBlackTree>("rbtree", *workloads[w]);
+        benchmarkBalance<WeightBalancedTree>("wbtree", *workloads[w]);
+    }
+}
+
+/**
+ * @brief Scaling benchmark of the concurrent tree and the sharded index
+ * against a globally locked AVL tree, from 1 to 64 threads, n operations per run.
+ *
+ * @param n The number of operations per run (and twice the prefill size).
+ */
+void runThreadBenchmark(int n)
+{
+    printf("threads  locked-avl Mops/s  concurrent Mops/s  sharded Mops/s  (%u hardware threads)\n",
+           thread::hardware_concurrency());
+    for (int threads = 1; threads <= 64; threads *= 2)
+    {
+        double locked = measureThreads<LockedIndex<AVLTree>>(n, threads);
+        double concurrent = measureThreads<ConcurrentTree>(n, threads);
+        double sharded = measureThreads<ShardedIndex>(n, threads);
+        printf("%7d  %17.2f  %17.2f  %14.2f\n", threads, locked, concurrent, sharded);
+    }
+}
+
+/**
+ * @brief The backends the benchmark suite runs by default: every stream backend.
+ */
+const char SUITE_BACKENDS[] = "avl,treap,rbtree,wbtree,bptree,persistent,concurrent,sharded,lsm,aggregate,finger,fenwick";
+
+/**
+ * @brief Distinct keys in the suite's duplicate-heavy stream.
+ */
+const int SUITE_DISTINCT = 1024;
+
+/**
+ * @brief Splits a comma separated list such as "avl,treap".
+ */
+vector<string> splitList(const char *text)
+{
+    vector<string> items;
+    string item;
+    for (; *text != '\0'; text++)
+    {
+        if (*text == ',')
+        {
+            items.push_back(item);
+            item.clear();
+        }
+        else
+        {
+            item += *text;
+        }
+    }
+    items.push_back(item);
+    return items;
+}
+
+/**
+ * @brief One key stream of the benchmark suite: n keys to build the index
+ * from, followed by `extra` more of the same kind for the timed inserts.
+ *
+ * @param distribution "random" (uniform over the non-negative ints),
+ *        "sorted" (0, 1, 2, ...) or "duplicates" (SUITE_DISTINCT distinct keys).
+ */
+vector<int> suiteKeys(const string &distribution, int n, int extra)
+{
+    mt19937 generator(n);
+    vector<int> keys((size_t)n + extra);
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (distribution == "sorted")
+        {
+            keys[i] = (int)i;
+        }
+        else if (distribution == "duplicates")
+        {
+            keys[i] = (int)(generator() % SUITE_DISTINCT);
+        }
+        else
+        {
+            keys[i] = (int)(generator() >> 1);
+        }
+    }
+    return keys;
+}
+
+/**
+ * @brief Throughput and latency percentiles of one operation as JSON.
+ *
+ * @param batchNanos The time of an uninterrupted run of the operation.
+ * @param batchOps The number of operations in that run.
+ * @param latencies Single operations timed one at a time, in nanoseconds
+ *        (clock overhead included); sorted in place.
+ */
+string operationJson(double batchNanos, long long batchOps, vector<double> &latencies)
+{
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p)
+    { return latencies.empty() ? 0.0 : latencies[nearestRank(p, (long long)latencies.size()) - 1]; };
+    char text[256];
+    snprintf(text, sizeof(text),
+             "{\"mops\":%.3f,\"p50_ns\":%.0f,\"p90_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"max_ns\":%.0f}",
+             batchOps / max(batchNanos, 1.0) * 1e3, percentile(50), percentile(90), percentile(99), percentile(99.9),
+             latencies.empty() ? 0.0 : latencies.back());
+    return text;
+}
+
+/**
+ * @brief Runs the suite's operations on one index and returns their results
+ * as JSON members. The index is built from the first n keys (the bulk-build
+ * time, and the insert throughput); then the 2 * samples extra keys are
+ * inserted, the first half one at a time for the insert latencies, and
+ * erased again, the first half in one run for the erase throughput and the
+ * second one at a time. Select and rank are timed the same two ways on
+ * random positions and on keys drawn from the stream.
+ *
+ * @param tree The index, empty.
+ * @param keys n + 2 * samples keys.
+ * @param n The size of the index while it is measured.
+ * @param samples The operations timed per measurement.
+ */
+template <typename Tree>
+string benchmarkSuiteRun(Tree &tree, const vector<int> &keys, int n, int samples)
+{
+    mt19937 generator(12345);
+    auto nanosSince = [](chrono::steady_clock::time_point start)
+    { return (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count(); };
+    vector<double> latencies(samples);
+    long long checksum = 0;
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++)
+    {
+        tree.insert(keys[i]);
+    }
+    double buildNanos = nanosSince(start);
+
+    for (int i = 0; i < samples; i++)
+    {
+        auto at = chrono::steady_clock::now();
+        tree.insert(keys[n + i]);
+        latencies[i] = nanosSince(at);
+    }
+    string insert = operationJson(buildNanos, n, latencies);
+    for (int i = samples; i < 2 * samples; i++)
+    {
+        tree.insert(keys[n + i]);
+    }
+
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < samples; i++)
+    {
+        tree.erase(keys[n + i]);
+    }
+    double eraseNanos = nanosSince(start);
+    for (int i = 0; i < samples; i++)
+    {
+        auto at = chrono::steady_clock::now();
+        tree.erase(keys[n + samples + i]);
+        latencies[i] = nanosSince(at);
+    }
+    string erase = operationJson(eraseNanos, samples, latencies);
+
+    // Select, then rank: one uninterrupted run and one timed per operation.
+    vector<int> arguments(samples);
+    uniform_int_distribution<int> positions(1, max(tree.size(), 1));
+    for (int i = 0; i < samples; i++)
+    {
+        arguments[i] = positions(generator);
+    }
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < samples; i++)
+    {
+        int value = 0;
+        tree.select(arguments[i], value);
+        checksum += value;
+    }
+    double selectNanos = nanosSince(start);
+    for (int i = 0; i < samples; i++)
+    {
+        int value = 0;
+        auto at = chrono::steady_clock::now();
+        tree.select(arguments[i], value);
+        latencies[i] = nanosSince(at);
+        checksum += value;
+    }
+    string select = operationJson(selectNanos, samples, latencies);
+
+    for (int i = 0; i < samples; i++)
+    {
+        arguments[i] = keys[generator() % n];
+    }
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < samples; i++)
+    {
+        checksum += tree.getRank(arguments[i]);
+    }
+    double rankNanos = nanosSince(start);
+    for (int i = 0; i < samples; i++)
+    {
+        auto at = chrono::steady_clock::now();
+        checksum += tree.getRank(arguments[i]);
+        latencies[i] = nanosSince(at);
+    }
+    string rank = operationJson(rankNanos, samples, latencies);
+
+    char build[64];
+    snprintf(build, sizeof(build), "\"build_ms\":%.3f", buildNanos / 1e6);
+    return string(build) + ",\"ops\":{\"insert\":" + insert + ",\"erase\":" + erase + ",\"select\":" + select +
+           ",\"rank\":" + rank + "},\"checksum\":" + to_string(checksum);
+}
+
+/**
+ * @brief benchmarkSuiteRun() on the named backend.
+ *
+ * @return string The results, or a "skipped" member with the reason when the
+ *         backend does not apply to these keys (fenwick over a domain larger
+ *         than FENWICK_MAX_DOMAIN), so a skipped run is still recorded.
+ */
+string benchmarkSuiteBackend(const string &backend, const vector<int> &keys, int n, int samples)
+{
+    if (backend == "avl")
+    {
+        AVLTree tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "treap")
+    {
+        TreapTree tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "rbtree")
+    {
+        RedBlackTree tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "wbtree")
+    {
+        WeightBalancedTree tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "bptree")
+    {
+        BPlusTree tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "persistent")
+    {
+        PersistentTree tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "concurrent")
+    {
+        ConcurrentTree tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "sharded")
+    {
+        ShardedIndex tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "lsm")
+    {
+        LSMStore tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "aggregate")
+    {
+        AugmentedTree<int, less<int>, SumMinMaxAggregate<int>> tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "finger")
+    {
+        FingerTree tree;
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    else if (backend == "fenwick")
+    {
+        auto range = minmax_element(keys.begin(), keys.end());
+        if ((long long)*range.second - *range.first >= FENWICK_MAX_DOMAIN)
+        {
+            return "\"skipped\":\"domain too large\"";
+        }
+        FenwickIndex tree(*range.first, *range.second);
+        return benchmarkSuiteRun(tree, keys, n, samples);
+    }
+    return "\"skipped\":\"unknown backend\"";
+}
+
+/**
+ * @brief The benchmark suite: every backend on every key stream at every
+ * size, written to stdout as one JSON document with one result per line, so
+ * runs from two commits can be diffed or compared by a script.
+ *
+ * @param sizes The numbers of keys; up to 10^9 (memory permitting).
+ *
+ * Every backend, key stream and size gets a record; one that does not apply
+ * has a "skipped" member with the reason instead of the results.
+ * @param distributions Key streams, see suiteKeys().
+ * @param backends Stream backend names.
+ * @param samples The operations timed per measurement (at most n each).
+ */
+void runBenchmarkSuite(const vector<int> &sizes, const vector<string> &distributions,
+                       const vector<string> &backends, int samples)
+{
+    printf("{\"suite\":\"order-statistics\",\"samples\":%d,\"hardware_threads\":%u,\"results\":[", samples,
+           thread::hardware_concurrency());
+    bool first = true;
+    for (int n : sizes)
+    {
+        int timed = min(samples, n);
+        for (const string &distribution : distributions)
+        {
+            vector<int> keys = suiteKeys(distribution, n, 2 * timed);
+            for (const string &backend : backends)
+            {
+                string result = benchmarkSuiteBackend(backend, keys, n, timed);
+                printf("%s\n{\"backend\":\"%s\",\"keys\":\"%s\",\"n\":%d,%s}", first ? "" : ",", backend.c_str(),
+                       distribution.c_str(), n, result.c_str());
+                fflush(stdout);
+                first = false;
+            }
+        }
+    }
+    printf("\n]}\n");
+}
+
+/**
+ * @brief Program driver. Takes input from the command line, read to EOF.
+ * 1st line = all space seperated node values to be inserted into the BBST
+ *            (values may continue over further lines).
+ * Last line = the ordering statistic(s) to be used in the select function.
+ * With --binary, the values come from a file of raw int32 or int64 integers
+ * instead, and every integer on stdin is an ordering statistic.
+ *
+ * A single ordering statistic is answered by selecting directly on the
+ * parsed values (no tree is built), on every core for large inputs; several,
+ * or --tree, build the BBST once and select from it for each. Without
+ * --tree, values from a small range are counted in a FenwickIndex instead.
+ *
+ * With --stream, commands are read from the given file (or stdin) instead;
+ * with --range, a sequence and range queries; with --window or --sketch, samples.
+ *
+ * @param argc Number of CLI provided arguments.
+ * @param argv CLI arguments.
+ * @return int A success status code of 0.
+ */
+int main(int argc, char *argv[])
+{
+    if (argc >= 2 && strcmp(argv[1], "--stream") == 0)
+    {
+        string backend;
+        FILE *input = stdin;
+        bool hasDomain = false;
+        int domainLow = 0, domainHigh = 0;
+        for (int i = 2; i < argc; i++)
+        {
+            if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc)
+            {
+                backend = argv[++i];
+            }
+            else if (strcmp(argv[i], "--domain") == 0 && i + 2 < argc)
+            {
+                hasDomain = true;
+                domainLow = atoi(argv[++i]);
+                domainHigh = atoi(argv[++i]);
+            }
+            else if (input == stdin)
+            {
+                input = fopen(argv[i], "r");
+                if (input == NULL)
+                {
+                    cout << "Error opening command file: " << argv[i] << "\n";
+                    return 1;
+                }
+            }
+        }
+
+        // A small enough key domain picks the Fenwick backend unless one was named.
+        bool smallDomain = hasDomain && domainLow <= domainHigh &&
+                           (long long)domainHigh - domainLow < FENWICK_MAX_DOMAIN;
+        if (backend.empty())
+        {
+            backend = smallDomain ? "fenwick" : "avl";
+        }
+
+        int errors;
+        if (backend == "avl")
+        {
+            AVLTree tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "treap")
+        {
+            TreapTree tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "rbtree")
+        {
+            RedBlackTree tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "wbtree")
+        {
+            WeightBalancedTree tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "sharded")
+        {
+            ShardedIndex tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "lsm")
+        {
+            LSMStore tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "finger")
+        {
+            FingerTree tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "fenwick")
+        {
+            if (!smallDomain)
+            {
+                cout << "The fenwick backend needs --domain <lo> <hi> spanning at most " << FENWICK_MAX_DOMAIN
+                     << " keys\n";
+                return 1;
+            }
+            FenwickIndex tree(domainLow, domainHigh);
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "bptree")
+        {
+            BPlusTree tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "persistent")
+        {
+            PersistentTree tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "concurrent")
+        {
+            ConcurrentTree tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else if (backend == "aggregate")
+        {
+            AugmentedTree<int, less<int>, SumMinMaxAggregate<int>> tree;
+            errors = runStream(input, stdout, tree);
+        }
+        else
+        {
+            cout << "Unknown backend: " << backend
+                 << " (expected avl, treap, rbtree, wbtree, bptree, persistent, concurrent, sharded, lsm, aggregate,"
+                 << " finger or fenwick)\n";
+            return 1;
+        }
+
+        if (input != stdin)
+        {
+            fclose(input);
+        }
+        return errors == 0 ? 0 : 1;
+    }
+    else if (argc >= 2 && strcmp(argv[1], "--range") == 0)
+    {
+        FILE *input = stdin;
+        string backend = "wavelet";
+        int i = 2;
+        if (i + 1 < argc && strcmp(argv[i], "--backend") == 0)
+        {
+            backend = argv[i + 1];
+            i += 2;
+        }
+        if (backend != "wavelet" && backend != "segment")
+        {
+            cout << "Unknown range backend: " << backend << " (expected wavelet or segment)\n";
+            return 1;
+        }
+        if (i < argc)
+        {
+            input = fopen(argv[i], "r");
+            if (input == NULL)
+            {
+                cout << "Error opening query file: " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        int errors;
+        if (backend == "segment")
+        {
+            PersistentSegmentTree index;
+            errors = runRange(input, stdout, index);
+        }
+        else
+        {
+            WaveletMatrix index;
+            errors = runRange(input, stdout, index);
+        }
+        if (input != stdin)
+        {
+            fclose(input);
+        }
+        return errors == 0 ? 0 : 1;
+    }
+    else if (argc >= 4 && strcmp(argv[1], "--window") == 0)
+    {
+        int capacity = atoi(argv[2]);
+        vector<double> percentiles;
+        if (!parsePercentiles(argv[3], percentiles))
+        {
+            cout << "Invalid percentile list: " << argv[3] << "\n";
+            return 1;
+        }
+        if (capacity < 1)
+        {
+            cout << "Usage: ./a.out --window <N> <p1,p2,...> [<sample_file>]\n";
+            return 1;
+        }
+
+        FILE *input = stdin;
+        if (argc >= 5)
+        {
+            input = fopen(argv[4], "r");
+            if (input == NULL)
+            {
+                cout << "Error opening sample file: " << argv[4] << "\n";
+                return 1;
+            }
+        }
+        int errors = runWindow(input, stdout, capacity, percentiles);
+        if (input != stdin)
+        {
+            fclose(input);
+        }
+        return errors == 0 ? 0 : 1;
+    }
+    else if (argc >= 4 && strcmp(argv[1], "--sketch") == 0)
+    {
+        double epsilon = atof(argv[2]);
+        vector<double> percentiles;
+        if (!(epsilon > 0 && epsilon < 1) || !parsePercentiles(argv[3], percentiles))
+        {
+            cout << "Usage: ./a.out --sketch <epsilon> <p1,p2,...> [<sample_file>]\n";
+            return 1;
+        }
+
+        FILE *input = stdin;
+        if (argc >= 5)
+        {
+            input = fopen(argv[4], "r");
+            if (input == NULL)
+            {
+                cout << "Error opening sample file: " << argv[4] << "\n";
+                return 1;
+            }
+        }
+        int errors = runSketch(input, epsilon, percentiles);
+        if (input != stdin)
+        {
+            fclose(input);
+        }
+        return errors == 0 ? 0 : 1;
+    }
+    else if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+    {
+        runBenchmark(argc >= 3 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    else if (argc >= 2 && strcmp(argv[1], "--bench-balance") == 0)
+    {
+        runBalanceBenchmark(argc >= 3 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    else if (argc >= 2 && strcmp(argv[1], "--bench-threads") == 0)
+    {
+        runThreadBenchmark(argc >= 3 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    else if (argc >= 2 && strcmp(argv[1], "--bench-suite") == 0)
+    {
+        vector<int> sizes = {1000, 10000, 100000, 1000000};
+        vector<string> distributions = {"random", "sorted", "duplicates"};
+        vector<string> known = splitList(SUITE_BACKENDS);
+        vector<string> backends = known;
+        int samples = 100000;
+        for (int i = 2; i < argc; i += 2)
+        {
+            if (i + 1 == argc)
+            {
+                cout << "Missing value for " << argv[i] << "\n";
+                return 1;
+            }
+            if (strcmp(argv[i], "--sizes") == 0)
+            {
+                // Sizes may be written as 1e9.
+                sizes.clear();
+                for (const string &size : splitList(argv[i + 1]))
+                {
+                    double n = atof(size.c_str());
+                    if (n < 1 || n > 1e9)
+                    {
+                        cout << "Sizes must be between 1 and 1e9: " << size << "\n";
+                        return 1;
+                    }
+                    sizes.push_back((int)n);
+                }
+            }
+            else if (strcmp(argv[i], "--keys") == 0)
+            {
+                distributions = splitList(argv[i + 1]);
+                for (const string &distribution : distributions)
+                {
+                    if (distribution != "random" && distribution != "sorted" && distribution != "duplicates")
+                    {
+                        cout << "Unknown key stream: " << distribution << " (expected random, sorted or duplicates)\n";
+                        return 1;
+                    }
+                }
+            }
+            else if (strcmp(argv[i], "--backends") == 0)
+            {
+                backends = splitList(argv[i + 1]);
+                for (const string &backend : backends)
+                {
+                    if (find(known.begin(), known.end(), backend) == known.end())
+                    {
+                        cout << "Unknown backend: " << backend << " (expected " << SUITE_BACKENDS << ")\n";
+                        return 1;
+                    }
+                }
+            }
+            else if (strcmp(argv[i], "--samples") == 0 && atoi(argv[i + 1]) > 0)
+            {
+                samples = atoi(argv[i + 1]);
+            }
+            else
+            {
+                cout << "Usage: ./a.out --bench-suite [--sizes <n1,n2,...>] [--keys random,sorted,duplicates]"
+                     << " [--backends <name,...>] [--samples <k>]\n"
+                     << "Default sizes are 1e3,1e4,1e5,1e6; sizes up to 1e9 are opt-in via --sizes.\n";
+                return 1;
+            }
+        }
+        runBenchmarkSuite(sizes, distributions, backends, samples);
+        return 0;
+    }
+    else if (argc >= 3 && strcmp(argv[1], "--load") == 0)
+    {
+        MappedTree tree;
+        if (!tree.open(argv[2]))
+        {
+            cout << "Error opening snapshot: " << argv[2] << "\n";
+            return 1;
+        }
+        if (argc >= 4 && strcmp(argv[3], "--verify") == 0 && !tree.verify())
+        {
+            cout << "Corrupt snapshot: " << argv[2] << "\n";
+            return 1;
+        }
+
+        // Every whitespace separated position on stdin is answered in turn,
+        // selected in batches.
+        const int BATCH = 4096;
+        InputScanner scanner(stdin);
+        OutputBuffer out(stdout);
+        vector<int> positions, results(BATCH);
+        bool found[BATCH];
+        bool done = false;
+        while (!done)
+        {
+            positions.clear();
+            while ((int)positions.size() < BATCH && !(done = scanner.peek() == EOF))
+            {
+                int position;
+                if (scanner.readInt(position))
+                {
+                    positions.push_back(position);
+                }
+                else
+                {
+                    out.flush();
+                    reportMalformed(scanner, "position");
+                }
+            }
+
+            tree.selectBatch(positions.data(), (int)positions.size(), results.data(), found);
+            for (size_t i = 0; i < positions.size(); i++)
+            {
+                if (found[i])
+                {
+                    out.writeInt(results[i]);
+                }
+                else
+                {
+                    out.writeString("none");
+                }
+                out.writeChar('\n');
+            }
+        }
+        return 0;
+    }
+
+    // Classic mode flags.
+    bool forceTree = false;
+    const char *snapshotPath = NULL;
+    int binaryWidth = 0;
+    const char *binaryPath = NULL;
+    bool stats = false;
+    bool usage = false;
+    for (int i = 1; i < argc && !usage; i++)
+    {
+        if (strcmp(argv[i], "--tree") == 0)
+        {
+            forceTree = true;
+        }
+        else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+        {
+            snapshotPath = argv[++i];
+            forceTree = true;
+        }
+        else if (strcmp(argv[i], "--stats") == 0)
+        {
+#ifdef BBST_STATS
+            stats = true;
+            forceTree = true;
+#else
+            cout << "--stats needs a build with -DBBST_STATS\n";
+            return 1;
+#endif
+        }
+        else if (strcmp(argv[i], "--binary") == 0 && i + 2 < argc)
+        {
+            binaryWidth = strcmp(argv[i + 1], "int32") == 0 ? 4 : strcmp(argv[i + 1], "int64") == 0 ? 8 : 0;
+            binaryPath = argv[i + 2];
+            usage = binaryWidth == 0;
+            i += 2;
+        }
+        else
+        {
+            usage = true;
+        }
+    }
+    if (usage)
+    {
+        cout << "Usage: ./a.out [--tree] [--save <snapshot>] [--stats] [--binary int32|int64 <value_file>]"
+             << " | ./a.out --load <snapshot> [--verify]"
+             << " | ./a.out --stream [--backend avl|treap|rbtree|wbtree|bptree|persistent|concurrent"
+             << "|sharded|lsm|aggregate|finger|fenwick]"
+             << " [--domain <lo> <hi>]"
+             << " [<command_file>] | ./a.out --range [--backend wavelet|segment] [<query_file>]"
+             << " | ./a.out --window <N> <p1,p2,...> [<sample_file>]"
+             << " | ./a.out --sketch <epsilon> <p1,p2,...> [<sample_file>]"
+             << " | ./a.out --bench [<n>] | ./a.out --bench-balance [<n>] | ./a.out --bench-threads [<n>]"
+             << " | ./a.out --bench-suite [--sizes <n1,n2,...>] [--keys <streams>] [--backends <names>]"
+             << " [--samples <k>] (default sizes 1e3,1e4,1e5,1e6; up to 1e9 via --sizes)\n";
+        return 1;
+    }
+
+    vector<int> inputNodes, positions;
+    int inputErrors;
+
+    // Create our root node for reference.
+    Node *root = NULL;
+
+    if (binaryPath != NULL)
+    {
+        // Values from the binary file; every integer on stdin is a position.
+        FILE *values = fopen(binaryPath, "rb");
+        if (values == NULL)
+        {
+            cout << "Error opening value file: " << binaryPath << "\n";
+            return 1;
+        }
+        inputErrors = readClassicBinary(values, binaryWidth, inputNodes);
+        fclose(values);
+
+        vector<int> lines;
+        inputErrors += readClassicText(stdin, lines, positions);
+        positions.insert(positions.begin(), lines.begin(), lines.end());
+    }
+    else
+    {
+        inputErrors = readClassicText(stdin, inputNodes, positions);
+    }
+    // Skipped input is reported token by token on stderr; the answers are
+    // still given for the rest, and the exit status flags the skips.
+    int status = inputErrors == 0 ? 0 : 1;
+
+    if (positions.size() == 1 && !forceTree)
+    {
+        // One query: selecting on the array beats building a tree for it.
+        int value;
+        int threads = (int)thread::hardware_concurrency();
+        bool found = inputNodes.size() >= (size_t)PARALLEL_SELECT_MIN && threads > 1
+                         ? parallelSelect(inputNodes, positions[0], threads, value)
+                         : selectInPlace(inputNodes, positions[0], value);
+        if (found)
+        {
+            cout << value << endl;
+        }
+        else
+        {
+            cout << "none" << endl;
+        }
+        return status;
+    }
+
+    // Several queries over a small key range: count per key instead of building a tree.
+    if (!forceTree && !inputNodes.empty())
+    {
+        auto range = minmax_element(inputNodes.begin(), inputNodes.end());
+        long long span = (long long)*range.second - *range.first + 1;
+        if (span <= FENWICK_MAX_DOMAIN && span <= max(4 * (long long)inputNodes.size(), 1LL << 16))
+        {
+            FenwickIndex index(*range.first, *range.second);
+            index.insertAll(inputNodes);
+            for (size_t i = 0; i < positions.size(); i++)
+            {
+                int value;
+                if (index.select(positions[i], value))
+                {
+                    cout << value << "\n";
+                }
+                else
+                {
+                    cout << "none\n";
+                }
+            }
+            return status;
+        }
+    }
+
+    // Create our BBST.
+    for (int i = 0; i < (int)inputNodes.size(); i++)
+    {
+        root = insert(root, inputNodes.at(i));
+    }
+
+    if (snapshotPath != NULL && !saveSnapshot(root, snapshotPath))
+    {
+        cout << "Error writing snapshot: " << snapshotPath << "\n";
+        return 1;
+    }
+
+    // Find and print the desired node by each ordering statistic. i.e., 5th lowest value.
+    // The queries are independent, so their descents are interleaved.
+    vector<Node *> selected(positions.size());
+    selectBatch(positions.data(), (int)positions.size(), root, selected.data());
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        Node *found = selected[i];
+        if (found != NULL)
+        {
+            cout << found->value << "\n";
+        }
+        else
+        {
+            cout << "none\n";
+        }
+    }
+
+#ifdef BBST_STATS
+    if (stats)
+    {
+        cout.flush();
+        fprintf(stderr, "%s\n", treeStatsJson(root).c_str());
+    }
+#else
+    (void)stats;
+#endif
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,1259 @@
+/**
+ * @file BBSTSelectTest.cpp
+ * @brief Differential tests for the order-statistic indexes in bbst/.
+ *
+ * Every index is driven with the same random operations as a plain sorted
+ * vector, the reference, and every answer is compared: select (including
+ * positions out of range), rank, countLess and countRange (including
+ * inverted ranges). The operation streams cover wide random keys with the
+ * int extremes, duplicate-heavy keys and sorted keys, with erases of
+ * missing values mixed in, and end by draining the index. The other
+ * structures are checked the same way against brute force.
+ *
+ * Build: g++ -O2 -std=c++17 -pthread BBSTSelectTest.cpp
+ *        (add -DBBST_STATS to check the instrumentation counters too)
+ * Run:   ./a.out   (prints each failure and exits non-zero if there are any)
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "bbst/avl.h"
+#include "bbst/balanced.h"
+#include "bbst/sharded.h"
+#include "bbst/lsm.h"
+#include "bbst/window.h"
+#include "bbst/snapshot.h"
+#include "bbst/fenwick.h"
+#include "bbst/frozen.h"
+#include "bbst/augmented.h"
+#include "bbst/bplus.h"
+#include "bbst/persistent.h"
+#include "bbst/concurrent.h"
+#include "bbst/sketch.h"
+#include "bbst/select.h"
+#include "bbst/range.h"
+#include "bbst/io.h"
+
+int failures = 0;
+
+/**
+ * @brief Records a failed check; only the first few failures are printed.
+ */
+void check(bool ok, const string &test, const string &what)
+{
+    if (!ok)
+    {
+        if (failures < 50)
+        {
+            printf("FAIL %s: %s\n", test.c_str(), what.c_str());
+        }
+        failures++;
+    }
+}
+
+/**
+ * @brief The reference multiset: a sorted vector.
+ */
+class Reference
+{
+public:
+    void insert(int value)
+    {
+        auto position = upper_bound(values.begin(), values.end(), value);
+        values.insert(position, value);
+    }
+
+    void erase(int value)
+    {
+        auto found = lower_bound(values.begin(), values.end(), value);
+        if (found != values.end() && *found == value)
+        {
+            values.erase(found);
+        }
+    }
+
+    bool select(int position, int &value) const
+    {
+        if (position < 1 || position > (int)values.size())
+        {
+            return false;
+        }
+        value = values[position - 1];
+        return true;
+    }
+
+    int getRank(int value) const { return upper_bound(values.begin(), values.end(), value) - values.begin(); }
+    int countLess(int value) const { return lower_bound(values.begin(), values.end(), value) - values.begin(); }
+    int countRange(int low, int high) const { return low > high ? 0 : getRank(high) - countLess(low); }
+    int size() const { return values.size(); }
+
+    vector<int> values;
+};
+
+/**
+ * @brief Checks the AVL invariants of a subtree: keys in order, stored
+ * heights and balance, and the children counts.
+ *
+ * @return int The number of values in the subtree, or -1 if it is malformed.
+ */
+int checkShape(Node *node, long long low, long long high)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    if (node->value < low || node->value > high)
+    {
+        return -1;
+    }
+    int left = checkShape(node->left, low, (long long)node->value - 1);
+    int right = checkShape(node->right, (long long)node->value + 1, high);
+    int balance = height(node->left) - height(node->right);
+    if (left < 0 || right < 0 || balance < -1 || balance > 1 ||
+        node->height != 1 + max(height(node->left), height(node->right)) || node->numLeftChildren != left ||
+        node->numRightChildren != right)
+    {
+        return -1;
+    }
+    return node->count >= 1 ? left + right + node->count : -1;
+}
+
+/**
+ * @brief Whether an index's internal structure is sound; only the AVL
+ * based ones expose theirs.
+ */
+template <typename Tree>
+bool wellFormed(const Tree &)
+{
+    return true;
+}
+
+bool wellFormed(const AVLTree &tree) { return checkShape(tree.getRoot(), INT_MIN, INT_MAX) == tree.size(); }
+
+bool wellFormed(const FingerTree &tree) { return checkShape(tree.getRoot(), INT_MIN, INT_MAX) == tree.size(); }
+
+/**
+ * @brief The black height of a red-black subtree whose values lie in
+ * [low, high], or -1 when its order, sizes or colors are broken.
+ */
+int blackHeight(const RankedNode *node, long long low, long long high)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    bool red = node->balance == 1;
+    int left = blackHeight(node->left, low, (long long)node->value - 1);
+    int right = blackHeight(node->right, (long long)node->value + 1, high);
+    if (left < 0 || right < 0 || left != right || node->value < low || node->value > high || node->count < 1 ||
+        node->size != rankedSize(node->left) + rankedSize(node->right) + node->count ||
+        (red && ((node->left != NULL && node->left->balance == 1) || (node->right != NULL && node->right->balance == 1))))
+    {
+        return -1;
+    }
+    return left + (red ? 0 : 1);
+}
+
+bool wellFormed(const RedBlackTree &tree)
+{
+    return blackHeight(tree.getRoot(), INT_MIN, INT_MAX) >= 0 && (tree.getRoot() == NULL || tree.getRoot()->balance == 0);
+}
+
+/**
+ * @brief A stream of keys of one kind.
+ *
+ * @param kind "wide" (any int, the extremes included), "duplicates" (eight
+ *        distinct keys) or "sorted" (increasing, with repeats).
+ */
+int nextKey(const string &kind, mt19937 &generator, int step)
+{
+    if (kind == "duplicates")
+    {
+        return (int)(generator() % 8) - 4;
+    }
+    if (kind == "sorted")
+    {
+        return step / 2;
+    }
+    switch (generator() % 16)
+    {
+    case 0:
+        return INT_MIN;
+    case 1:
+        return INT_MAX;
+    default:
+        return (int)generator();
+    }
+}
+
+/**
+ * @brief Compares every query of an index against the reference at a few
+ * probe keys and positions, out-of-range ones included.
+ */
+template <typename Tree>
+void compareQueries(const string &test, const Tree &tree, const Reference &reference, mt19937 &generator,
+                    const string &kind, int step)
+{
+    int n = reference.size();
+    check((int)tree.size() == n, test, "size " + to_string(tree.size()) + " != " + to_string(n));
+
+    int positions[] = {0, 1, n, n + 1, -1, 1 + (int)(generator() % (n + 1))};
+    for (int position : positions)
+    {
+        int expected = 0, actual = 0;
+        bool expectedFound = reference.select(position, expected);
+        bool actualFound = tree.select(position, actual);
+        check(expectedFound == actualFound && (!expectedFound || expected == actual), test,
+              "select(" + to_string(position) + ")");
+    }
+
+    int keys[] = {INT_MIN, INT_MAX, nextKey(kind, generator, step), nextKey(kind, generator, step),
+                  n > 0 ? reference.values[generator() % n] : 0};
+    for (int key : keys)
+    {
+        check(tree.getRank(key) == reference.getRank(key), test, "getRank(" + to_string(key) + ")");
+        check(tree.countLess(key) == reference.countLess(key), test, "countLess(" + to_string(key) + ")");
+        for (int other : keys)
+        {
+            check(tree.countRange(key, other) == reference.countRange(key, other), test,
+                  "countRange(" + to_string(key) + ", " + to_string(other) + ")");
+        }
+    }
+}
+
+/**
+ * @brief Drives an index and the reference with the same random inserts
+ * and erases (a third of them, half of those of values that may be absent),
+ * then erases everything in random order, comparing all queries every few
+ * operations.
+ */
+template <typename Tree>
+void checkIndex(const string &name, Tree &tree, const string &kind, int operations, unsigned seed)
+{
+    string test = name + "/" + kind;
+    mt19937 generator(seed);
+    Reference reference;
+    for (int step = 0; step < operations; step++)
+    {
+        if (generator() % 3 == 0 && reference.size() > 0)
+        {
+            int value = generator() % 2 == 0 ? reference.values[generator() % reference.size()]
+                                             : nextKey(kind, generator, step);
+            tree.erase(value);
+            reference.erase(value);
+        }
+        else
+        {
+            int value = nextKey(kind, generator, step);
+            tree.insert(value);
+            reference.insert(value);
+        }
+        if (step % 7 == 0 || step == operations - 1)
+        {
+            compareQueries(test, tree, reference, generator, kind, step);
+            check(wellFormed(tree), test, "malformed after step " + to_string(step));
+        }
+    }
+
+    vector<int> remaining = reference.values;
+    shuffle(remaining.begin(), remaining.end(), generator);
+    for (size_t i = 0; i < remaining.size(); i++)
+    {
+        tree.erase(remaining[i]);
+        reference.erase(remaining[i]);
+        if (i % 7 == 0 || i + 1 == remaining.size())
+        {
+            compareQueries(test + "/drain", tree, reference, generator, kind, operations);
+            check(wellFormed(tree), test + "/drain", "malformed after erase " + to_string(i));
+        }
+    }
+}
+
+/**
+ * @brief checkIndex() on a default constructed index, once per key stream.
+ */
+template <typename Tree>
+void checkBackend(const string &name, int operations)
+{
+    const char *kinds[] = {"wide", "duplicates", "sorted"};
+    for (int k = 0; k < 3; k++)
+    {
+        Tree tree;
+        checkIndex(name, tree, kinds[k], operations, 1000 + k);
+    }
+}
+
+void testBackends()
+{
+    const int operations = 3000;
+    checkBackend<AVLTree>("avl", operations);
+    checkBackend<FingerTree>("finger", operations);
+    checkBackend<TreapTree>("treap", operations);
+    checkBackend<RedBlackTree>("rbtree", operations);
+    checkBackend<WeightBalancedTree>("wbtree", operations);
+    checkBackend<BPlusTree>("bptree", operations);
+    checkBackend<PersistentTree>("persistent", operations);
+    checkBackend<ConcurrentTree>("concurrent", operations);
+    checkBackend<ShardedIndex>("sharded", operations);
+    checkBackend<LSMStore>("lsm", operations);
+    checkBackend<AugmentedTree<int, less<int>, SumMinMaxAggregate<int>>>("aggregate", operations);
+
+    // The domain covers only part of each stream, so keys spill on both sides.
+    const char *kinds[] = {"wide", "duplicates", "sorted"};
+    for (int k = 0; k < 3; k++)
+    {
+        FenwickIndex fenwick(-2, 500);
+        checkIndex("fenwick", fenwick, kinds[k], operations, 1000 + k);
+    }
+}
+
+/**
+ * @brief A version taken from a persistent tree keeps its answers while the
+ * tree is updated, also when it is read from another thread meanwhile.
+ */
+void testPersistentVersions()
+{
+    mt19937 generator(3);
+    PersistentTree tree;
+    Reference reference;
+    for (int i = 0; i < 2000; i++)
+    {
+        int value = nextKey("wide", generator, i);
+        tree.insert(value);
+        reference.insert(value);
+    }
+    auto version = tree.snapshot();
+    Reference old = reference;
+
+    atomic<bool> done(false);
+    atomic<int> torn(0);
+    thread reader(
+        [&tree, &done, &torn]()
+        {
+            while (!done.load())
+            {
+                auto current = tree.snapshot();
+                int n = current.size(), first = 0, last = 0, past = 0;
+                if (n > 0 && (!current.select(1, first) || !current.select(n, last) || first > last ||
+                              current.select(n + 1, past)))
+                {
+                    torn++;
+                }
+            }
+        });
+    for (int i = 0; i < 3000; i++)
+    {
+        int value = generator() % 3 == 0 ? old.values[generator() % old.size()] : nextKey("wide", generator, i);
+        if (i % 3 == 0)
+        {
+            tree.erase(value);
+            reference.erase(value);
+        }
+        else
+        {
+            tree.insert(value);
+            reference.insert(value);
+        }
+    }
+    done = true;
+    reader.join();
+
+    check(torn == 0, "persistent", "a reader saw an inconsistent version");
+    for (int i = 0; i < 20; i++)
+    {
+        compareQueries("persistent/old version", version, old, generator, "wide", 0);
+        compareQueries("persistent/current", tree, reference, generator, "wide", 0);
+    }
+}
+
+/**
+ * @brief Concurrent inserts and erases from several threads, with a reader
+ * running alongside, end in the same tree as the same updates made in turn.
+ */
+template <typename Tree>
+void checkConcurrentUpdates(const string &test)
+{
+    const int threads = 4, perThread = 5000;
+    Tree tree;
+    atomic<bool> done(false);
+    atomic<int> bad(0);
+    thread reader(
+        [&tree, &done, &bad]()
+        {
+            while (!done.load())
+            {
+                int value = 0;
+                if (tree.select(1, value) && (value < 0 || value >= threads * perThread))
+                {
+                    bad++;
+                }
+            }
+        });
+
+    vector<thread> writers;
+    for (int t = 0; t < threads; t++)
+    {
+        writers.emplace_back(
+            [&tree, t]()
+            {
+                for (int i = 0; i < perThread; i++)
+                {
+                    tree.insert(i * threads + t);
+                }
+                for (int i = 1; i < perThread; i += 2)
+                {
+                    tree.erase(i * threads + t);
+                }
+            });
+    }
+    for (thread &writer : writers)
+    {
+        writer.join();
+    }
+    done = true;
+    reader.join();
+
+    check(bad == 0, test, "a reader saw a value never inserted");
+    Reference reference;
+    for (int t = 0; t < threads; t++)
+    {
+        for (int i = 0; i < perThread; i += 2)
+        {
+            reference.insert(i * threads + t);
+        }
+    }
+    mt19937 generator(4);
+    for (int i = 0; i < 50; i++)
+    {
+        compareQueries(test, tree, reference, generator, "sorted", i * 397);
+    }
+}
+
+/**
+ * @brief Appends a subtree's values, every copy, in order.
+ */
+void collect(Node *node, vector<int> &values)
+{
+    if (node != NULL)
+    {
+        collect(node->left, values);
+        values.insert(values.end(), node->count, node->value);
+        collect(node->right, values);
+    }
+}
+
+Node *buildTree(const vector<int> &values)
+{
+    Node *root = NULL;
+    for (int value : values)
+    {
+        root = insert(root, value);
+    }
+    return root;
+}
+
+/**
+ * @brief Split, join and the parallel set operations against the same
+ * operations on sorted vectors (std::set_union and friends have the same
+ * multiset semantics: counts add, take the minimum, subtract).
+ */
+void testJoinSplit()
+{
+    mt19937 generator(5);
+    int budgets[] = {0, 1, defaultThreadBudget()};
+    for (int round = 0; round < 30; round++)
+    {
+        string kind = round % 2 ? "duplicates" : "wide";
+        int budget = budgets[round % 3];
+        vector<int> a, b;
+        for (int i = (int)(generator() % 3000); i > 0; i--)
+        {
+            a.push_back(nextKey(kind, generator, i));
+        }
+        for (int i = (int)(generator() % 3000); i > 0; i--)
+        {
+            b.push_back(nextKey(kind, generator, i));
+        }
+        sort(a.begin(), a.end());
+        sort(b.begin(), b.end());
+
+        vector<int> expected, actual;
+        merge(a.begin(), a.end(), b.begin(), b.end(), back_inserter(expected));
+        Node *root = unionTrees(buildTree(a), buildTree(b), budget);
+        collect(root, actual);
+        check(actual == expected && checkShape(root, INT_MIN, INT_MAX) == (int)expected.size(), "join", "union");
+        deleteTree(root);
+
+        expected.clear();
+        actual.clear();
+        set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(expected));
+        root = intersectTrees(buildTree(a), buildTree(b), budget);
+        collect(root, actual);
+        check(actual == expected && checkShape(root, INT_MIN, INT_MAX) == (int)expected.size(), "join",
+              "intersection");
+        deleteTree(root);
+
+        expected.clear();
+        actual.clear();
+        set_difference(a.begin(), a.end(), b.begin(), b.end(), back_inserter(expected));
+        root = differenceTrees(buildTree(a), buildTree(b), budget);
+        collect(root, actual);
+        check(actual == expected && checkShape(root, INT_MIN, INT_MAX) == (int)expected.size(), "join",
+              "difference");
+        deleteTree(root);
+
+        expected.clear();
+        actual.clear();
+        merge(a.begin(), a.end(), b.begin(), b.end(), back_inserter(expected));
+        root = insertSorted(buildTree(a), b, budget);
+        collect(root, actual);
+        check(actual == expected && checkShape(root, INT_MIN, INT_MAX) == (int)expected.size(), "join",
+              "insertSorted");
+
+        // Split at a present value and at a probe, then join the pieces back.
+        int at = expected.empty() || round % 4 == 0 ? nextKey(kind, generator, 0)
+                                                    : expected[generator() % expected.size()];
+        Node *less = NULL, *greater = NULL;
+        Node *middle = split(root, at, less, greater);
+        vector<int> below, above;
+        collect(less, below);
+        collect(greater, above);
+        int copies = (int)(upper_bound(expected.begin(), expected.end(), at) -
+                           lower_bound(expected.begin(), expected.end(), at));
+        check(below == vector<int>(expected.begin(), lower_bound(expected.begin(), expected.end(), at)) &&
+                  above == vector<int>(upper_bound(expected.begin(), expected.end(), at), expected.end()) &&
+                  checkShape(less, INT_MIN, INT_MAX) == (int)below.size() &&
+                  checkShape(greater, INT_MIN, INT_MAX) == (int)above.size(),
+              "join", "split at " + to_string(at));
+        check(copies == 0 ? middle == NULL : middle != NULL && middle->value == at && middle->count == copies, "join",
+              "split middle at " + to_string(at));
+
+        root = middle != NULL ? join(less, middle, greater) : join2(less, greater);
+        actual.clear();
+        collect(root, actual);
+        check(actual == expected && checkShape(root, INT_MIN, INT_MAX) == (int)expected.size(), "join",
+              "join after split");
+        deleteTree(root);
+    }
+}
+
+/**
+ * @brief Range aggregates against summing the range by hand, and trees
+ * ordered by another comparator or over another key type.
+ */
+void testAggregates()
+{
+    mt19937 generator(6);
+    AugmentedTree<int, less<int>, SumMinMaxAggregate<int>> tree;
+    Reference reference;
+    for (int i = 0; i < 3000; i++)
+    {
+        int value = (int)(generator() % 2000) - 1000;
+        if (i % 4 == 3)
+        {
+            tree.erase(value);
+            reference.erase(value);
+        }
+        else
+        {
+            tree.insert(value);
+            reference.insert(value);
+        }
+        if (i % 13 != 0)
+        {
+            continue;
+        }
+        int low = (int)(generator() % 2200) - 1100, high = (int)(generator() % 2200) - 1100;
+        long long sum = 0;
+        int minimum = INT_MAX, maximum = INT_MIN;
+        for (int value : reference.values)
+        {
+            if (value >= low && value <= high)
+            {
+                sum += value;
+                minimum = min(minimum, value);
+                maximum = max(maximum, value);
+            }
+        }
+        auto aggregate = tree.aggregateRange(low, high);
+        check(aggregate.sum == sum && aggregate.min == minimum && aggregate.max == maximum, "aggregate",
+              "aggregateRange(" + to_string(low) + ", " + to_string(high) + ")");
+        check(tree.aggregateAll().sum == accumulate(reference.values.begin(), reference.values.end(), 0LL),
+              "aggregate", "aggregateAll");
+    }
+
+    AugmentedTree<int, greater<int>> descending;
+    for (int value : {5, 1, 9, 9, 3})
+    {
+        descending.insert(value);
+    }
+    int first = 0, last = 0;
+    check(descending.select(1, first) && first == 9 && descending.select(5, last) && last == 1 &&
+              descending.getRank(5) == 3 && descending.countRange(9, 3) == 4,
+          "aggregate", "greater<int> order");
+
+    AugmentedTree<string> words;
+    for (const char *word : {"pear", "apple", "fig", "apple"})
+    {
+        words.insert(word);
+    }
+    string word;
+    check(words.select(2, word) && word == "apple" && words.select(3, word) && word == "fig" &&
+              words.countLess("b") == 2,
+          "aggregate", "string keys");
+}
+
+/**
+ * @brief Batched select, also on positions out of range, against select().
+ */
+void testSelectBatch()
+{
+    mt19937 generator(7);
+    AVLTree tree;
+    Reference reference;
+    for (int i = 0; i < 5000; i++)
+    {
+        int value = nextKey(i % 2 ? "duplicates" : "wide", generator, i);
+        tree.insert(value);
+        reference.insert(value);
+    }
+    vector<int> positions;
+    for (int i = -2; i <= reference.size() + 2; i += 3)
+    {
+        positions.push_back(i);
+    }
+    shuffle(positions.begin(), positions.end(), generator);
+    vector<Node *> found(positions.size());
+    selectBatch(positions.data(), (int)positions.size(), tree.getRoot(), found.data());
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        int expected;
+        bool present = reference.select(positions[i], expected);
+        check(present == (found[i] != NULL) && (!present || found[i]->value == expected), "batch",
+              "selectBatch(" + to_string(positions[i]) + ")");
+    }
+}
+
+/**
+ * @brief The Eytzinger-layout copy of a tree answers like the tree.
+ */
+void testFrozen()
+{
+    const char *kinds[] = {"wide", "duplicates", "sorted"};
+    for (int k = 0; k < 3; k++)
+    {
+        mt19937 generator(8 + k);
+        for (int n : {0, 1, 2, 3, 7, 100, 5000})
+        {
+            AVLTree tree;
+            Reference reference;
+            for (int i = 0; i < n; i++)
+            {
+                int value = nextKey(kinds[k], generator, i);
+                tree.insert(value);
+                reference.insert(value);
+            }
+            FrozenIndex frozen;
+            frozen.freeze(tree.getRoot());
+            for (int i = 0; i < 10; i++)
+            {
+                compareQueries("frozen/" + string(kinds[k]), frozen, reference, generator, kinds[k], n);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Bulk loading a Fenwick index matches inserting one at a time.
+ */
+void testFenwickBulk()
+{
+    mt19937 generator(9);
+    vector<int> values;
+    Reference reference;
+    for (int i = 0; i < 5000; i++)
+    {
+        values.push_back((int)(generator() % 1200) - 100);
+        reference.insert(values.back());
+    }
+    FenwickIndex fenwick(0, 999);
+    fenwick.insertAll(values);
+    for (int i = 0; i < 20; i++)
+    {
+        compareQueries("fenwick/insertAll", fenwick, reference, generator, "duplicates", 0);
+    }
+}
+
+/**
+ * @brief Iterator seeks and steps, and rank and key scans, against the
+ * sorted values.
+ */
+void testScans()
+{
+    mt19937 generator(10);
+    AVLTree tree;
+    Reference reference;
+    for (int i = 0; i < 3000; i++)
+    {
+        int value = nextKey(i % 2 ? "duplicates" : "wide", generator, i);
+        tree.insert(value);
+        reference.insert(value);
+    }
+    const vector<int> &sorted = reference.values;
+    int n = reference.size();
+
+    for (int i = 0; i < 50; i++)
+    {
+        int first = (int)(generator() % (n + 4)) - 2, last = (int)(generator() % (n + 4)) - 2;
+        vector<int> ranks;
+        scanByRank(tree.getRoot(), first, last, [&ranks](int value) { ranks.push_back(value); });
+        int from = max(first, 1), to = min(last, n);
+        check(ranks == (from <= to ? vector<int>(sorted.begin() + from - 1, sorted.begin() + to) : vector<int>()),
+              "scan", "scanByRank(" + to_string(first) + ", " + to_string(last) + ")");
+
+        int low = nextKey("duplicates", generator, 0), high = nextKey("duplicates", generator, 0);
+        vector<int> keys;
+        scanByKey(tree.getRoot(), low, high, [&keys](int value) { keys.push_back(value); });
+        check(keys == (low <= high ? vector<int>(lower_bound(sorted.begin(), sorted.end(), low),
+                                                 upper_bound(sorted.begin(), sorted.end(), high))
+                                   : vector<int>()),
+              "scan", "scanByKey(" + to_string(low) + ", " + to_string(high) + ")");
+    }
+
+    TreeIterator iterator(tree.getRoot());
+    check(iterator.seekRank(1) && iterator.value() == sorted[0] && iterator.rank() == 1, "iterator", "seekRank(1)");
+    for (int i = 1; i < n; i++)
+    {
+        iterator.next();
+        if (!iterator.valid() || iterator.value() != sorted[i] || iterator.rank() != i + 1)
+        {
+            check(false, "iterator", "next() at rank " + to_string(i + 1));
+            break;
+        }
+    }
+    iterator.next();
+    check(!iterator.valid(), "iterator", "next() past the end");
+    check(!iterator.seekRank(0) && !iterator.seekRank(n + 1), "iterator", "seekRank out of range");
+    check(iterator.seekRank(n), "iterator", "seekRank(n)");
+    for (int i = n - 2; i >= 0; i--)
+    {
+        iterator.prev();
+        if (!iterator.valid() || iterator.value() != sorted[i] || iterator.rank() != i + 1)
+        {
+            check(false, "iterator", "prev() at rank " + to_string(i + 1));
+            break;
+        }
+    }
+    for (int key : {INT_MIN, -3, 0, 2, sorted[n / 2], INT_MAX})
+    {
+        auto at = lower_bound(sorted.begin(), sorted.end(), key);
+        bool found = iterator.seekKey(key);
+        check(found == (at != sorted.end()) &&
+                  (!found || (iterator.value() == *at && iterator.rank() == at - sorted.begin() + 1)),
+              "iterator", "seekKey(" + to_string(key) + ")");
+    }
+}
+
+/**
+ * @brief Saving a tree and mapping the file gives the same answers.
+ */
+void testSnapshot()
+{
+    mt19937 generator(12);
+    string path = "/tmp/bbst_test_" + to_string(getpid()) + ".snap";
+    for (int n : {0, 1, 5000})
+    {
+        AVLTree tree;
+        Reference reference;
+        for (int i = 0; i < n; i++)
+        {
+            int value = nextKey(i % 2 ? "duplicates" : "wide", generator, i);
+            tree.insert(value);
+            reference.insert(value);
+        }
+        check(saveSnapshot(tree.getRoot(), path.c_str()), "snapshot", "save");
+        MappedTree mapped;
+        check(mapped.open(path.c_str()) && mapped.verify(), "snapshot", "open");
+        for (int i = 0; i < 20; i++)
+        {
+            compareQueries("snapshot/" + to_string(n), mapped, reference, generator, "wide", 0);
+        }
+
+        vector<int> positions;
+        for (int i = -2; i <= n + 2; i += 3)
+        {
+            positions.push_back(i);
+        }
+        vector<int> results(positions.size());
+        unique_ptr<bool[]> present(new bool[positions.size()]);
+        mapped.selectBatch(positions.data(), (int)positions.size(), results.data(), present.get());
+        for (size_t i = 0; i < positions.size(); i++)
+        {
+            int expected;
+            bool exists = reference.select(positions[i], expected);
+            check(exists == present[i] && (!exists || results[i] == expected), "snapshot",
+                  "selectBatch(" + to_string(positions[i]) + ")");
+        }
+    }
+
+    // Damaged nodes behind a valid header: open() only reads the header, so
+    // it accepts them, but queries must not loop or crash and verify() must
+    // reject the image.
+    FILE *file = fopen(path.c_str(), "r+b");
+    fseek(file, -40, SEEK_END);
+    for (int i = 0; i < 40; i++)
+    {
+        fputc(i % 2 ? 0xff : 0x7f, file);
+    }
+    fclose(file);
+    MappedTree damaged;
+    check(damaged.open(path.c_str()), "snapshot", "damaged nodes open");
+    check(!damaged.verify(), "snapshot", "damaged snapshot verified");
+    int value;
+    for (int position = 1; position <= damaged.size(); position += 97)
+    {
+        damaged.select(position, value);
+        damaged.getRank(position);
+        damaged.countLess(-position);
+    }
+    vector<int> positions = {1, damaged.size() / 2, damaged.size()};
+    vector<int> results(positions.size());
+    bool present[3];
+    damaged.selectBatch(positions.data(), (int)positions.size(), results.data(), present);
+    damaged.close();
+
+    // A truncated file no longer matches its header's node count.
+    check(truncate(path.c_str(), sizeof(SnapshotHeader) + 10 * sizeof(SnapshotNode) + 3) == 0, "snapshot",
+          "truncate");
+    check(!damaged.open(path.c_str()), "snapshot", "truncated snapshot accepted");
+    unlink(path.c_str());
+}
+
+/**
+ * @brief The wavelet matrix and the persistent segment tree (built on 1 to
+ * 8 threads) against sorting each queried range.
+ */
+void testRangeIndexes()
+{
+    mt19937 generator(11);
+    for (int round = 0; round < 6; round++)
+    {
+        int n = round == 0 ? 1 : 20000 + (int)(generator() % 20000);
+        vector<int> sequence(n);
+        for (int i = 0; i < n; i++)
+        {
+            sequence[i] = round % 2 ? (int)(generator() % 5) : (int)generator();
+        }
+        WaveletMatrix wavelet;
+        wavelet.build(sequence);
+        PersistentSegmentTree segment;
+        segment.build(sequence, 1 << (round % 4));
+
+        for (int query = 0; query < 200; query++)
+        {
+            size_t left = generator() % n, right = generator() % (n + 1);
+            if (left > right)
+            {
+                swap(left, right);
+            }
+            vector<int> sorted(sequence.begin() + left, sequence.begin() + right);
+            sort(sorted.begin(), sorted.end());
+            size_t k = generator() % (sorted.size() + 2);
+            int probe = query % 4 == 0 ? (int)generator() : sequence[generator() % n];
+            size_t expectedRank = upper_bound(sorted.begin(), sorted.end(), probe) - sorted.begin();
+            bool expectedFound = k >= 1 && k <= sorted.size();
+
+            int value = 0;
+            bool found = wavelet.rangeQuantile(left, right, k, value);
+            check(found == expectedFound && (!expectedFound || value == sorted[k - 1]), "wavelet", "rangeQuantile");
+            check(wavelet.rangeRank(left, right, probe) == expectedRank, "wavelet", "rangeRank");
+            found = segment.rangeQuantile(left, right, k, value);
+            check(found == expectedFound && (!expectedFound || value == sorted[k - 1]), "segment", "rangeQuantile");
+            check(segment.rangeRank(left, right, probe) == expectedRank, "segment", "rangeRank");
+        }
+    }
+}
+
+/**
+ * @brief Array selection, sequential and parallel (forced thread counts),
+ * at the extremes and in between.
+ */
+void testArraySelect()
+{
+    mt19937 generator(13);
+    for (int round = 0; round < 12; round++)
+    {
+        int n = 1 + (int)(generator() % 200000);
+        vector<int> values(n);
+        for (int &value : values)
+        {
+            // Heavy duplication and the int extremes, as well as plain keys.
+            value = round % 3 == 0 ? (int)(generator() % 2) : round % 3 == 1 ? nextKey("wide", generator, 0)
+                                                                              : (int)generator();
+        }
+        vector<int> sorted = values;
+        sort(sorted.begin(), sorted.end());
+
+        int positions[] = {1, 2, n, max(n - 1, 1), 1 + (int)(generator() % n)};
+        for (int position : positions)
+        {
+            vector<int> copy = values;
+            int result = 0;
+            check(selectInPlace(copy, position, result) && result == sorted[position - 1], "select",
+                  "selectInPlace(" + to_string(position) + ")");
+            copy = values;
+            check(parallelSelect(copy, position, 1 + round % 8, result) && result == sorted[position - 1], "select",
+                  "parallelSelect(" + to_string(position) + ")");
+        }
+
+        vector<int> copy = values;
+        int k = (int)(generator() % n);
+        floydRivestSelect(copy, 0, n - 1, k);
+        check(copy[k] == sorted[k] && *max_element(copy.begin(), copy.begin() + k + 1) == copy[k] &&
+                  *min_element(copy.begin() + k, copy.end()) == copy[k],
+              "select", "floydRivestSelect partition");
+
+        int result;
+        copy = values;
+        check(!selectInPlace(copy, 0, result) && !selectInPlace(copy, n + 1, result), "select",
+              "selectInPlace out of range");
+        check(!parallelSelect(copy, 0, 4, result) && !parallelSelect(copy, n + 1, 4, result), "select",
+              "parallelSelect out of range");
+    }
+}
+
+/**
+ * @brief The nearest-rank position of the p-th percentile of n values.
+ */
+long long percentileRank(double percentile, long long n)
+{
+    return min(max((long long)ceil(percentile / 100.0 * n), 1LL), n);
+}
+
+/**
+ * @brief The sliding window against the sorted last N samples.
+ */
+void testWindow()
+{
+    mt19937 generator(17);
+    for (int capacity : {1, 2, 100})
+    {
+        SlidingWindow window(capacity);
+        vector<int> samples;
+        int value = 0;
+        check(!window.percentile(50, value), "window", "percentile of an empty window");
+        for (int i = 0; i < 2000; i++)
+        {
+            int sample = i % 500 < 250 ? (int)(generator() % 50) : nextKey("wide", generator, i);
+            window.push(sample);
+            samples.push_back(sample);
+            vector<int> last(samples.end() - min<size_t>(samples.size(), capacity), samples.end());
+            sort(last.begin(), last.end());
+            check(window.size() == (int)last.size(), "window", "size");
+            for (double percentile : {0.0, 50.0, 99.0, 100.0})
+            {
+                check(window.percentile(percentile, value) &&
+                          value == last[percentileRank(percentile, (long long)last.size()) - 1],
+                      "window", to_string(capacity) + " samples, percentile " + to_string(percentile));
+            }
+        }
+    }
+}
+
+/**
+ * @brief The sketch's rank error against its bound, for one sketch and for
+ * two merged ones.
+ */
+void testSketch()
+{
+    mt19937 generator(19);
+    double epsilon = 0.01;
+    KLLSketch sketch(epsilon), left(epsilon), right(epsilon);
+    vector<int> all;
+    for (int i = 0; i < 200000; i++)
+    {
+        int value = i % 3 == 0 ? (int)(generator() % 100) : (int)generator();
+        sketch.insert(value);
+        (i % 2 ? left : right).insert(value);
+        all.push_back(value);
+    }
+    left.merge(right);
+    sort(all.begin(), all.end());
+    long long n = all.size();
+    check(sketch.size() == n && left.size() == n, "sketch", "size");
+
+    KLLSketch *sketches[] = {&sketch, &left};
+    for (KLLSketch *tested : sketches)
+    {
+        long long worst = 0;
+        for (int p = 1; p < 100; p++)
+        {
+            long long position = percentileRank(p, n);
+            int value = 0;
+            tested->select(position, value);
+            // Any position holding the returned value is as good as another.
+            long long below = lower_bound(all.begin(), all.end(), value) - all.begin();
+            long long through = upper_bound(all.begin(), all.end(), value) - all.begin();
+            worst = max(worst, position <= below ? below + 1 - position : position > through ? position - through : 0);
+        }
+        check(worst <= 2 * epsilon * n, "sketch",
+              string(tested == &sketch ? "" : "merged ") + "rank error " + to_string(worst));
+    }
+}
+
+/**
+ * @brief Writes text to a temporary file and rewinds it for reading.
+ */
+FILE *inputFile(const string &text)
+{
+    FILE *file = tmpfile();
+    fwrite(text.data(), 1, text.size(), file);
+    rewind(file);
+    return file;
+}
+
+/**
+ * @brief The classic-mode readers: values over several lines, the
+ * positions on the last one, malformed and out-of-range tokens, and raw
+ * binary input.
+ */
+void testClassicReaders()
+{
+    vector<int> values, positions;
+    FILE *input = inputFile("5 -3 2147483647\n  -2147483648 7 \n\n2 4\n");
+    check(readClassicText(input, values, positions) == 0 && values == vector<int>({5, -3, INT_MAX, INT_MIN, 7}) &&
+              positions == vector<int>({2, 4}),
+          "classic", "text over several lines");
+    fclose(input);
+
+    values.clear();
+    positions.clear();
+    input = inputFile("1 2 3");
+    check(readClassicText(input, values, positions) == 0 && values == vector<int>({1, 2, 3}) && positions.empty(),
+          "classic", "a single line is all values");
+    fclose(input);
+
+    values.clear();
+    positions.clear();
+    input = inputFile("1 x2 3 99999999999\n1\n");
+    check(readClassicText(input, values, positions) == 2 && values == vector<int>({1, 3}) &&
+              positions == vector<int>({1}),
+          "classic", "malformed tokens");
+    fclose(input);
+
+    // A token longer than the old 64-byte carry, cut by the first block boundary.
+    string text;
+    while (text.size() < (1 << 16) - 100)
+    {
+        text += "1 ";
+    }
+    text += string(300, '0') + "42\n3\n";
+    values.clear();
+    positions.clear();
+    input = inputFile(text);
+    check(readClassicText(input, values, positions) == 0 && values.size() == ((1 << 16) - 100) / 2 + 1 &&
+              values.back() == 42 && positions == vector<int>({3}),
+          "classic", "long token across a block boundary");
+    fclose(input);
+
+    int32_t narrow[] = {4, -1, INT_MAX, INT_MIN};
+    input = tmpfile();
+    fwrite(narrow, sizeof(narrow[0]), 4, input);
+    fputc(0, input);
+    rewind(input);
+    values.clear();
+    check(readClassicBinary(input, 4, values) == 1 && values == vector<int>({4, -1, INT_MAX, INT_MIN}), "classic",
+          "int32 with a truncated tail");
+    fclose(input);
+
+    int64_t wide[] = {4, (int64_t)INT_MAX + 1, -6, (int64_t)INT_MIN - 1};
+    input = tmpfile();
+    fwrite(wide, sizeof(wide[0]), 4, input);
+    rewind(input);
+    values.clear();
+    check(readClassicBinary(input, 8, values) == 2 && values == vector<int>({4, -6}), "classic",
+          "int64 out of the int range");
+    fclose(input);
+}
+
+/**
+ * @brief A sharded index keeps its answers across reconfiguration and
+ * rebalancing, and under concurrent updates.
+ */
+void testSharded()
+{
+    mt19937 generator(21);
+    ShardedIndex index(4);
+    Reference reference;
+    vector<int> sample;
+    for (int i = 0; i < 1000; i++)
+    {
+        sample.push_back((int)(generator() % 1000));
+    }
+    index.configure(sample);
+    for (int i = 0; i < 20000; i++)
+    {
+        // Skewed keys overfill one shard, which rebalancing has to split.
+        int value = i % 4 == 0 ? (int)(generator() % 1000) : 500 + (int)(generator() % 5);
+        index.insert(value);
+        reference.insert(value);
+        if (i % 2000 == 0)
+        {
+            index.rebalance();
+            compareQueries("sharded/skewed", index, reference, generator, "duplicates", i);
+        }
+    }
+    index.rebalance();
+    for (int i = 0; i < 20; i++)
+    {
+        compareQueries("sharded/skewed", index, reference, generator, "duplicates", i);
+    }
+    checkConcurrentUpdates<ShardedIndex>("sharded/threads");
+
+    // Select must see a shard's size and tree together: while -2 comes and
+    // goes at the top of shard 0, position 999 is always -2 or shard 1's 0.
+    ShardedIndex churned(2);
+    for (int i = -1000; i < 1000; i++)
+    {
+        if (i != -2 && i != -1)
+        {
+            churned.insert(i);
+        }
+    }
+    atomic<bool> done(false);
+    thread churn(
+        [&churned, &done]()
+        {
+            while (!done.load())
+            {
+                churned.insert(-2);
+                churned.erase(-2);
+            }
+        });
+    bool consistent = true;
+    for (int i = 0; i < 200000 && consistent; i++)
+    {
+        int value;
+        consistent = churned.select(999, value) && (value == -2 || value == 0);
+    }
+    done = true;
+    churn.join();
+    check(consistent, "sharded", "select during erase");
+}
+
+/**
+ * @brief With -DBBST_STATS the counters record the rotations and descents
+ * of a tree; without it there is nothing to check.
+ */
+void testStats()
+{
+#ifdef BBST_STATS
+    unsigned long long rotations = treeStats.leftRotations + treeStats.rightRotations;
+    unsigned long long inserts = treeStats.inserts, selects = treeStats.selects;
+    AVLTree tree;
+    for (int i = 0; i < 1000; i++)
+    {
+        tree.insert(i);
+    }
+    int value;
+    tree.select(500, value);
+    check(treeStats.leftRotations + treeStats.rightRotations - rotations >= 900, "stats", "rotations");
+    check(treeStats.inserts - inserts == 1000 && treeStats.selects - selects == 1, "stats", "inserts and selects");
+    check(treeStatsJson(tree.getRoot()).find("\"rotations\"") != string::npos, "stats", "json");
+#endif
+}
+
+/**
+ * @brief InputScanner reads commands and integers across line breaks and
+ * blank space, accepts the int extremes and rejects anything past them, and
+ * OutputBuffer writes them back.
+ */
+void testScanner()
+{
+    FILE *input = tmpfile();
+    fputs("I 5\n  S   -3\n\nC 2147483647 -2147483648\nR +7\nI 2147483648 -2147483649 99999999999999999999\nI 5\n",
+          input);
+    rewind(input);
+    InputScanner scanner(input);
+    int value = 0, other = 0;
+    check(scanner.next() == 'I' && scanner.readInt(value) && value == 5, "scanner", "I 5");
+    check(scanner.next() == 'S' && scanner.readInt(value) && value == -3, "scanner", "S -3");
+    check(scanner.next() == 'C' && scanner.readInt(value) && scanner.readInt(other) && value == INT_MAX &&
+              other == INT_MIN,
+          "scanner", "int extremes");
+    check(scanner.next() == 'R' && scanner.readInt(value) && value == 7, "scanner", "R +7");
+    check(scanner.next() == 'I' && !scanner.readInt(value) && scanner.outOfRange(), "scanner", "2147483648");
+    check(!scanner.readInt(value) && scanner.outOfRange(), "scanner", "-2147483649");
+    check(!scanner.readInt(value) && scanner.outOfRange(), "scanner", "20 digits");
+    check(scanner.next() == 'I' && scanner.readInt(value) && value == 5 && !scanner.outOfRange(), "scanner",
+          "after out of range");
+    check(scanner.next() == EOF, "scanner", "EOF");
+    fclose(input);
+
+    FILE *output = tmpfile();
+    {
+        OutputBuffer out(output);
+        out.writeInt(LLONG_MIN + 1);
+        out.writeChar(' ');
+        out.writeInt(0);
+        out.writeChar('\n');
+        for (int i = 0; i < 20000; i++)
+        {
+            out.writeInt(i);
+        }
+        out.flush();
+    }
+    string expected = to_string(LLONG_MIN + 1) + " 0\n";
+    for (int i = 0; i < 20000; i++)
+    {
+        expected += to_string(i);
+    }
+    rewind(output);
+    string written(expected.size() + 1, '\0');
+    written.resize(fread(&written[0], 1, written.size(), output));
+    check(written == expected, "output", "buffered writes");
+    fclose(output);
+}
+
+int main()
+{
+    testBackends();
+    testPersistentVersions();
+    checkConcurrentUpdates<ConcurrentTree>("concurrent/threads");
+    testJoinSplit();
+    testAggregates();
+    testArraySelect();
+    testWindow();
+    testSketch();
+    testSnapshot();
+    testClassicReaders();
+    testSelectBatch();
+    testFrozen();
+    testFenwickBulk();
+    testRangeIndexes();
+    testScans();
+    testSharded();
+    testStats();
+    testScanner();
+
+    if (failures > 0)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * @file augmented.h
+ * @brief Generic AVL tree with custom comparators and subtree aggregates.
+ */
+
+#ifndef BBST_AUGMENTED_H
+#define BBST_AUGMENTED_H
+
+#include "common.h"
+#include "avl.h"
+
+/**
+ * @brief Sum of the keys, counting every copy.
+ */
+template <typename Key>
+struct SumAggregate
+{
+    static constexpr bool enabled = true;
+    typedef long long value_type;
+    static value_type identity() { return 0; }
+    static value_type combine(value_type left, value_type right) { return left + right; }
+    static value_type lift(const Key &key, int copies) { return (value_type)key * copies; }
+};
+
+/**
+ * @brief Smallest key; the identity is the largest representable key.
+ */
+template <typename Key>
+struct MinAggregate
+{
+    static constexpr bool enabled = true;
+    typedef Key value_type;
+    static value_type identity() { return numeric_limits<Key>::max(); }
+    static value_type combine(const Key &left, const Key &right) { return min(left, right); }
+    static value_type lift(const Key &key, int) { return key; }
+};
+
+/**
+ * @brief Largest key; the identity is the smallest representable key.
+ */
+template <typename Key>
+struct MaxAggregate
+{
+    static constexpr bool enabled = true;
+    typedef Key value_type;
+    static value_type identity() { return numeric_limits<Key>::lowest(); }
+    static value_type combine(const Key &left, const Key &right) { return max(left, right); }
+    static value_type lift(const Key &key, int) { return key; }
+};
+
+/**
+ * @brief Sum, minimum and maximum of the keys in one pass.
+ */
+template <typename Key>
+struct SumMinMaxAggregate
+{
+    static constexpr bool enabled = true;
+    struct value_type
+    {
+        long long sum;
+        Key min;
+        Key max;
+    };
+    static value_type identity()
+    {
+        return {0, numeric_limits<Key>::max(), numeric_limits<Key>::lowest()};
+    }
+    static value_type combine(const value_type &left, const value_type &right)
+    {
+        return {left.sum + right.sum, std::min(left.min, right.min), std::max(left.max, right.max)};
+    }
+    static value_type lift(const Key &key, int copies) { return {(long long)key * copies, key, key}; }
+};
+
+/**
+ * @brief Generic counted AVL tree over any ordered key type, optionally
+ * augmented with a monoid aggregate of each subtree.
+ *
+ * A thin wrapper over the AVL core in avl.h instantiated on
+ * BasicNode<Key, Compare, Aggregate>: the balancing and counting are the int
+ * tree's (multiset semantics, one node per distinct key), and the core
+ * refreshes each node's cached aggregate wherever it updates the height and
+ * counts, so aggregateRange(lo, hi) combines O(log n) cached values. With
+ * NoAggregate the field and its upkeep compile away and the tree costs the
+ * same as AVLTree.
+ *
+ * @tparam Key The key type.
+ * @tparam Compare Strict weak ordering on keys.
+ * @tparam Aggregate NoAggregate or a monoid policy (see NoAggregate).
+ */
+template <typename Key, typename Compare = less<Key>, typename Aggregate = NoAggregate>
+class AugmentedTree
+{
+public:
+    typedef BasicNode<Key, Compare, Aggregate> AugmentedNode;
+    typedef typename Aggregate::value_type AggregateValue;
+
+    AugmentedTree() : root(NULL) {}
+    ~AugmentedTree() { deleteTree(root); }
+    AugmentedTree(const AugmentedTree &) = delete;
+    AugmentedTree &operator=(const AugmentedTree &) = delete;
+
+    void insert(const Key &key) { root = ::insert(root, key); }
+    void erase(const Key &key) { root = ::erase(root, key); }
+    int size() const { return subtreeSize(root); }
+
+    bool select(int position, Key &key) const
+    {
+        const AugmentedNode *node = ::select(position, (const AugmentedNode *)root);
+        if (node == NULL)
+        {
+            return false;
+        }
+        key = node->value;
+        return true;
+    }
+
+    // Number of keys <= key.
+    int getRank(const Key &key) const { return ::getRank(key, (const AugmentedNode *)root); }
+    int countLess(const Key &key) const { return ::countLess(key, (const AugmentedNode *)root); }
+    int countRange(const Key &low, const Key &high) const
+    {
+        return ::countRange(low, high, (const AugmentedNode *)root);
+    }
+
+    /**
+     * @brief Aggregate of every key in [low, high], in O(log n).
+     */
+    AggregateValue aggregateRange(const Key &low, const Key &high) const
+    {
+        static_assert(Aggregate::enabled, "aggregateRange() needs an aggregate policy");
+        const AugmentedNode *node = root;
+        // Walk down to the node where the paths to low and high part ways.
+        while (node != NULL)
+        {
+            if (compare(node->value, low))
+            {
+                node = node->right;
+            }
+            else if (compare(high, node->value))
+            {
+                node = node->left;
+            }
+            else
+            {
+                return Aggregate::combine(
+                    Aggregate::combine(aggregateFrom(node->left, low), Aggregate::lift(node->value, node->count)),
+                    aggregateUpTo(node->right, high));
+            }
+        }
+        return Aggregate::identity();
+    }
+
+    AggregateValue aggregateAll() const
+    {
+        static_assert(Aggregate::enabled, "aggregateAll() needs an aggregate policy");
+        return aggregateOf(root);
+    }
+
+private:
+    static bool compare(const Key &left, const Key &right) { return Compare()(left, right); }
+
+    // Aggregate of the keys >= low in a subtree.
+    static AggregateValue aggregateFrom(const AugmentedNode *node, const Key &low)
+    {
+        AggregateValue result = Aggregate::identity();
+        while (node != NULL)
+        {
+            if (compare(node->value, low))
+            {
+                node = node->right;
+            }
+            else
+            {
+                // This node and its right subtree are in; prepend them.
+                result = Aggregate::combine(
+                    Aggregate::combine(Aggregate::lift(node->value, node->count), aggregateOf(node->right)),
+                    result);
+                node = node->left;
+            }
+        }
+        return result;
+    }
+
+    // Aggregate of the keys <= high in a subtree.
+    static AggregateValue aggregateUpTo(const AugmentedNode *node, const Key &high)
+    {
+        AggregateValue result = Aggregate::identity();
+        while (node != NULL)
+        {
+            if (compare(high, node->value))
+            {
+                node = node->left;
+            }
+            else
+            {
+                result = Aggregate::combine(
+                    result,
+                    Aggregate::combine(aggregateOf(node->left), Aggregate::lift(node->value, node->count)));
+                node = node->right;
+            }
+        }
+        return result;
+    }
+
+    AugmentedNode *root;
+};
+
+#endif
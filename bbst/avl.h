@@ -0,0 +1,1620 @@
+/**
+ * @file avl.h
+ * @brief The AVL multiset at the core of BBSTSelect: nodes,
+ * insert/erase/select/rank, join and split, parallel set operations,
+ * iterators, AVLTree and FingerTree.
+ */
+
+#ifndef BBST_AVL_H
+#define BBST_AVL_H
+
+#include "common.h"
+#include "stats.h"
+
+/**
+ * @brief Aggregate policy that keeps nothing; nodes then store no aggregate
+ * field and the core skips the aggregate upkeep entirely.
+ *
+ * A real aggregate is a monoid over the stored keys:
+ *   enabled     true.
+ *   value_type  The aggregate type.
+ *   identity()  The neutral element.
+ *   combine(a, b)  Associative; a covers smaller keys than b.
+ *   lift(key, copies)  The aggregate of `copies` copies of one key.
+ * Keys can carry a payload (e.g. pair<latency, bytes> ordered by latency
+ * first) for aggregates such as the bytes below a latency threshold.
+ */
+struct NoAggregate
+{
+    static constexpr bool enabled = false;
+    struct value_type
+    {
+    };
+};
+
+/**
+ * @brief Storage for a node's subtree aggregate; empty (and, as a base
+ * class, zero bytes) when the aggregate is disabled.
+ */
+template <typename Aggregate, bool = Aggregate::enabled>
+struct AggregateSlot
+{
+    typename Aggregate::value_type aggregate;
+};
+
+template <typename Aggregate>
+struct AggregateSlot<Aggregate, false>
+{
+};
+
+/**
+ * @brief Node structure.
+ *
+ * Contains additional features for height: to easily calculate the balance factor,
+ * and the number of left and right children for each node: to assist with selection.
+ * Repeated values share one node: count is the value's multiplicity, and the
+ * numbers of children count every copy, so they are the number of values
+ * stored in each subtree rather than the number of nodes.
+ *
+ * The tree functions below are templates over the node type, so the same
+ * balancing and counting serve any key type, ordering and aggregate policy
+ * (see AugmentedTree). Node, the int tree used everywhere else, keeps no
+ * aggregate and has the same layout as a plain struct.
+ *
+ * @tparam Key The key type.
+ * @tparam Compare Strict weak ordering on keys.
+ * @tparam Aggregate NoAggregate or a monoid policy (see NoAggregate).
+ */
+template <typename Key, typename Compare = less<Key>, typename Aggregate = NoAggregate>
+class BasicNode : public AggregateSlot<Aggregate>
+{
+public:
+    typedef Key key_type;
+    typedef Compare key_compare;
+    typedef Aggregate aggregate_type;
+
+    Key value;
+    int count;
+    BasicNode *left;
+    BasicNode *right;
+    int height;
+    int numLeftChildren, numRightChildren;
+};
+
+typedef BasicNode<int> Node;
+
+/**
+ * @brief Whether one key orders before another under the node's comparator.
+ */
+template <typename N>
+inline bool keyLess(const typename N::key_type &left, const typename N::key_type &right)
+{
+    return typename N::key_compare()(left, right);
+}
+
+/**
+ * @brief Return the height of a given node.
+ *
+ * @param node A node.
+ * @return int The height of the node.
+ */
+template <typename N>
+inline int height(N *node)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    return node->height;
+}
+
+/**
+ * @brief Return the number of values (duplicates included) in the subtree
+ * rooted at a given node.
+ *
+ * @param node A node.
+ * @return int The size of the subtree, 0 for an empty subtree.
+ */
+template <typename N>
+inline int subtreeSize(N *node)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    return node->numLeftChildren + node->numRightChildren + node->count;
+}
+
+/**
+ * @brief The aggregate of a subtree, the identity for an empty one.
+ */
+template <typename N>
+inline typename N::aggregate_type::value_type aggregateOf(const N *node)
+{
+    typedef typename N::aggregate_type Aggregate;
+    if constexpr (Aggregate::enabled)
+    {
+        return node == NULL ? Aggregate::identity() : node->aggregate;
+    }
+    else
+    {
+        return typename Aggregate::value_type();
+    }
+}
+
+/**
+ * @brief Recompute a node's aggregate from its (already up to date) subtrees.
+ * Compiles to nothing without an aggregate.
+ *
+ * @param node A non-null node.
+ */
+template <typename N>
+inline void refreshAggregate(N *node)
+{
+    typedef typename N::aggregate_type Aggregate;
+    if constexpr (Aggregate::enabled)
+    {
+        node->aggregate = Aggregate::combine(
+            Aggregate::combine(aggregateOf(node->left), Aggregate::lift(node->value, node->count)),
+            aggregateOf(node->right));
+    }
+    else
+    {
+        (void)node;
+    }
+}
+
+/**
+ * @brief Recalculate the height and the number of children of a node
+ * from its (already up to date) left and right subtrees.
+ *
+ * @param node A non-null node.
+ */
+template <typename N>
+inline void updateNode(N *node)
+{
+    node->height = max(height(node->left), height(node->right)) + 1;
+    node->numLeftChildren = subtreeSize(node->left);
+    node->numRightChildren = subtreeSize(node->right);
+    refreshAggregate(node);
+}
+
+/**
+ * @brief Creates a new node and initializes its
+ * parameter. Public visibility for simplicity.
+ *
+ * @param value
+ * @return Node*
+ */
+template <typename N = Node>
+inline N *newNode(const typename N::key_type &value)
+{
+    BBST_STAT(statsAdd(treeStats.nodesAllocated));
+    N *node = new N();
+    node->value = value;
+    node->count = 1;
+    node->left = NULL;
+    node->right = NULL;
+    node->height = 1;
+    node->numLeftChildren = 0;
+    node->numRightChildren = 0;
+    refreshAggregate(node);
+    return (node);
+}
+
+/**
+ * @brief Right rotation.
+ * 1. Store inital pointers.
+ * 2. Connect the pivot as the left child for the new parent.
+ * 3. Connect the new parent's left child as the pivot's right child.
+ * 4. Update the number of children for each node involved in the rotation.
+ * 5. Update the height of the nodes involved for further balance tests.
+ *
+ * @param pivotNode The unbalanced node about which the rotation will occur.
+ * @return Node* The new parent node AFTER the rotation. To be connected back into the tree.
+ */
+template <typename N>
+inline N *rightRotate(N *pivotNode)
+{
+    BBST_STAT(statsAdd(treeStats.rightRotations));
+    BBST_STAT(threadRotations++);
+    N *newPivot = pivotNode->left;
+    N *newPivotRightChild = newPivot->right;
+
+    // Perform rotation
+    newPivot->right = pivotNode;
+    pivotNode->left = newPivotRightChild;
+
+    // Store necessary details of intial config.
+    int beginNewPivotRightChildren = newPivot->numRightChildren;
+    // Redetermine old pivot nodes new num of children.
+    pivotNode->numLeftChildren = beginNewPivotRightChildren;
+    newPivot->numRightChildren = subtreeSize(pivotNode);
+
+    // Recalculate heights
+    pivotNode->height = max(height(pivotNode->left), height(pivotNode->right)) + 1;
+    newPivot->height = max(height(newPivot->left), height(newPivot->right)) + 1;
+
+    // The old pivot is now the child, so its aggregate goes first.
+    refreshAggregate(pivotNode);
+    refreshAggregate(newPivot);
+
+    // Return new root
+    return newPivot;
+}
+
+/**
+ * @brief Left rotation.
+ * 1. Store inital pointers.
+ * 2. Connect the pivot as the right child for the new parent.
+ * 3. Connect the new parent's right child as the pivot's left child.
+ * 4. Update the number of children for each node involved in the rotation.
+ * 5. Update the height of the nodes involved for further balance tests.
+ *
+ * @param pivotNode The unbalanced node about which the rotation will occur.
+ * @return Node* The new parent node AFTER the rotation. To be connected back into the tree.
+ */
+template <typename N>
+inline N *leftRotate(N *pivotNode)
+{
+    BBST_STAT(statsAdd(treeStats.leftRotations));
+    BBST_STAT(threadRotations++);
+    N *newPivot = pivotNode->right;
+    N *leftChildOfNewPivot = newPivot->left;
+
+    // Perform rotation
+    newPivot->left = pivotNode;
+    pivotNode->right = leftChildOfNewPivot;
+
+    // Store necessary details of intial config.
+    int beginNewPivotLeftChildren = newPivot->numLeftChildren;
+    // Redetermine old pivot nodes new num of children.
+    pivotNode->numRightChildren = beginNewPivotLeftChildren;
+    newPivot->numLeftChildren = subtreeSize(pivotNode);
+
+    // Redetermine the node heights
+    pivotNode->height = max(height(pivotNode->left), height(pivotNode->right)) + 1;
+    newPivot->height = max(height(newPivot->left), height(newPivot->right)) + 1;
+
+    refreshAggregate(pivotNode);
+    refreshAggregate(newPivot);
+
+    // Return new root to connect to parent
+    return newPivot;
+}
+
+/**
+ * @brief Get the balance factor of a given node.
+ *
+ * @param node The node to calculate the balance factor.
+ * @return int The balance factor.
+ */
+template <typename N>
+inline int getBalance(N *node)
+{
+    if (node == NULL)
+    {
+        return 0;
+    }
+    return height(node->left) - height(node->right);
+}
+
+/**
+ * @brief Inserts a new node into the Balanced Binary Search Tree.
+ * 1. If no root: Insert the new node as the root.
+ * 2. Determine if the value of the new node is greater than or less than that
+ * of the currently in place node. Move down the tree accordingly.
+ * 3. Insert the node as a leaf node (where the are no nodes currently).
+ *    A value that is already present only has its count incremented.
+ * 4. Determine the balance factor for the BBST after the insertion.
+ * 4. Perform rotations upon unbalanced nodes as needed.
+ *
+ * @param node Initially, the root of the BBST. Recursion will update this
+ *             parameter throughout the function's life cycle.
+ * @param value The value of the new node.
+ * @param spare Optional: a previously unlinked node to recycle for the new
+ *              leaf instead of allocating one. Taken (set to NULL) when used.
+ * @return Node* Each recursion will return the current node it is on.
+ * Ultimately, the root node will be returned.
+ */
+template <typename N>
+inline N *insert(N *node, const typename N::key_type &value, N **spare = NULL)
+{
+    BBST_STAT(InsertProbe probe(node));
+    // If no root supplied, add the node as the root.
+    // OR
+    // Add the node as a leaf node.
+    if (node == NULL)
+    {
+        if (spare == NULL || *spare == NULL)
+        {
+            return (newNode<N>(value));
+        }
+        N *recycled = *spare;
+        *spare = NULL;
+        recycled->value = value;
+        recycled->count = 1;
+        recycled->left = NULL;
+        recycled->right = NULL;
+        recycled->height = 1;
+        recycled->numLeftChildren = 0;
+        recycled->numRightChildren = 0;
+        refreshAggregate(recycled);
+        return recycled;
+    }
+    // Is the node gt or lt the current node?
+    // Insert the node as a leaf.
+    if (keyLess<N>(value, node->value))
+    {
+        node->left = insert(node->left, value, spare);
+    }
+    else if (keyLess<N>(node->value, value))
+    {
+        node->right = insert(node->right, value, spare);
+    }
+    // Duplicate: one more copy, the shape of the tree does not change.
+    else
+    {
+        node->count++;
+        refreshAggregate(node);
+        return node;
+    }
+
+    // Calculate the height of the node and rebuild the number of children
+    // from the subtrees.
+    updateNode(node);
+
+    // Check the balance of the node.
+    int balance = getBalance(node);
+
+    // Left Left Rotation
+    if (balance > 1 && keyLess<N>(value, node->left->value))
+    {
+        BBST_STAT(statsAdd(treeStats.leftLeft));
+        return rightRotate(node);
+    }
+
+    // Right Right Rotation
+    if (balance < -1 && keyLess<N>(node->right->value, value))
+    {
+        BBST_STAT(statsAdd(treeStats.rightRight));
+        return leftRotate(node);
+    }
+
+    // Left Right Rotation
+    if (balance > 1 && keyLess<N>(node->left->value, value))
+    {
+        BBST_STAT(statsAdd(treeStats.leftRight));
+        node->left = leftRotate(node->left);
+        return rightRotate(node);
+    }
+
+    // Right Left Rotation
+    if (balance < -1 && keyLess<N>(value, node->right->value))
+    {
+        BBST_STAT(statsAdd(treeStats.rightLeft));
+        node->right = rightRotate(node->right);
+        return leftRotate(node);
+    }
+
+    return node;
+}
+
+/**
+ * @brief Restore the AVL property at a node whose subtrees differ in height by at most two.
+ * Used after deletions, where the inserted value is not available to pick the rotation case.
+ *
+ * @param node The node to rebalance. Its height and children counts must be current.
+ * @return Node* The root of the rebalanced subtree.
+ */
+template <typename N>
+inline N *rebalance(N *node)
+{
+    int balance = getBalance(node);
+
+    if (balance > 1)
+    {
+        // Left Right Rotation
+        if (getBalance(node->left) < 0)
+        {
+            BBST_STAT(statsAdd(treeStats.leftRight));
+            node->left = leftRotate(node->left);
+        }
+        // Left Left Rotation
+        else
+        {
+            BBST_STAT(statsAdd(treeStats.leftLeft));
+        }
+        return rightRotate(node);
+    }
+
+    if (balance < -1)
+    {
+        // Right Left Rotation
+        if (getBalance(node->right) > 0)
+        {
+            BBST_STAT(statsAdd(treeStats.rightLeft));
+            node->right = rightRotate(node->right);
+        }
+        // Right Right Rotation
+        else
+        {
+            BBST_STAT(statsAdd(treeStats.rightRight));
+        }
+        return leftRotate(node);
+    }
+
+    return node;
+}
+
+/**
+ * @brief Unlinks the node holding the smallest value of a subtree, without deleting it.
+ *
+ * @param node The root of a non-empty subtree.
+ * @param minNode Receives the unlinked node.
+ * @return Node* The root of the rebalanced subtree without that node.
+ */
+template <typename N>
+inline N *detachMin(N *node, N *&minNode)
+{
+    if (node->left == NULL)
+    {
+        minNode = node;
+        return node->right;
+    }
+    node->left = detachMin(node->left, minNode);
+    updateNode(node);
+    return rebalance(node);
+}
+
+/**
+ * @brief Removes one copy of a value from the Balanced Binary Search Tree.
+ * 1. Find the node holding the value. If it holds several copies, drop one.
+ * 2. A node with at most one child is replaced by that child.
+ * 3. A node with two children takes the value and count of its in-order
+ *    successor, whose node is then unlinked from the right subtree.
+ * 4. Rebalance every node on the way back up.
+ *
+ * @param node Initially, the root of the BBST.
+ * @param value The value to remove. Missing values leave the tree unchanged.
+ * @param freed Optional: receives the unlinked node instead of it being
+ *              deleted, when it does not already hold one (see insert()).
+ * @return Node* The root of the subtree after the removal.
+ */
+template <typename N>
+inline N *erase(N *node, const typename N::key_type &value, N **freed = NULL)
+{
+    if (node == NULL)
+    {
+        return NULL;
+    }
+
+    // Deletes an unlinked node, or hands it back through freed.
+    auto discard = [freed](N *unlinked)
+    {
+        if (freed != NULL && *freed == NULL)
+        {
+            *freed = unlinked;
+        }
+        else
+        {
+            delete unlinked;
+        }
+    };
+
+    if (keyLess<N>(value, node->value))
+    {
+        node->left = erase(node->left, value, freed);
+    }
+    else if (keyLess<N>(node->value, value))
+    {
+        node->right = erase(node->right, value, freed);
+    }
+    else if (node->count > 1)
+    {
+        node->count--;
+        refreshAggregate(node);
+        return node;
+    }
+    else
+    {
+        if (node->left == NULL || node->right == NULL)
+        {
+            N *child = node->left != NULL ? node->left : node->right;
+            discard(node);
+            return child;
+        }
+
+        N *successor;
+        node->right = detachMin(node->right, successor);
+        node->value = successor->value;
+        node->count = successor->count;
+        discard(successor);
+    }
+
+    updateNode(node);
+    return rebalance(node);
+}
+
+/**
+ * @brief Counts the values strictly less than a given value.
+ *
+ * @param value The value to compare against.
+ * @param root The root node of the BBST.
+ * @return int The number of values < value.
+ */
+template <typename N>
+inline int countLess(const typename N::key_type &value, N *root)
+{
+    int count = 0;
+    N *currNode = root;
+
+    while (currNode != NULL)
+    {
+        if (keyLess<N>(currNode->value, value))
+        {
+            // The current node and its whole left subtree are smaller.
+            count += currNode->numLeftChildren + currNode->count;
+            currNode = currNode->right;
+        }
+        else
+        {
+            currNode = currNode->left;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Rank of a value: the number of values less than or equal to it.
+ * When the value is in the tree, select(getRank(value)) returns its node.
+ *
+ * @param value The value to rank.
+ * @param root The root node of the BBST.
+ * @return int The number of values <= value.
+ */
+template <typename N>
+inline int getRank(const typename N::key_type &value, N *root)
+{
+    int count = 0;
+    N *currNode = root;
+
+    while (currNode != NULL)
+    {
+        if (!keyLess<N>(value, currNode->value))
+        {
+            count += currNode->numLeftChildren + currNode->count;
+            currNode = currNode->right;
+        }
+        else
+        {
+            currNode = currNode->left;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Counts the values within the closed range [low, high].
+ *
+ * @param low The lower bound.
+ * @param high The upper bound.
+ * @param root The root node of the BBST.
+ * @return int The number of values v with low <= v <= high.
+ */
+template <typename N>
+inline int countRange(const typename N::key_type &low, const typename N::key_type &high, N *root)
+{
+    if (keyLess<N>(high, low))
+    {
+        return 0;
+    }
+    return getRank(high, root) - countLess(low, root);
+}
+
+/**
+ * @brief Counts the nodes of a subtree, i.e. its distinct values.
+ *
+ * @param node The root of the subtree.
+ * @return long long The number of nodes.
+ */
+inline long long countNodes(Node *node)
+{
+    return node == NULL ? 0 : 1 + countNodes(node->left) + countNodes(node->right);
+}
+
+/**
+ * @brief Takes a user requested selection statistic,
+ * i.e., 12 representing the 12th lowest item in the BBST,
+ * and returns a reference to the Node at that location.
+ *
+ * @param position The position of the desired node.
+ * @param root The root node of the BBST.
+ * @return Node* The desired node, or NULL when the position is out of range.
+ */
+template <typename N>
+inline N *select(int position, N *root)
+{
+    // Positions outside [1, n] would walk off the bottom of the tree.
+    if (root != NULL && position >= 1 && position <= subtreeSize(root))
+    {
+        N *currNode = root;
+        BBST_STAT(int depth = 0);
+
+        while (true)
+        {
+            BBST_STAT(depth++);
+            // What is the current node's position? With duplicates the node
+            // covers positions myPosition to lastPosition.
+            int myPosition = currNode->numLeftChildren + 1;
+            int lastPosition = currNode->numLeftChildren + currNode->count;
+            // Is the desired position gt, lt, or equal to the current node's position?
+            if (position > lastPosition)
+            {
+                // Update the requested position to be equiv. to the desired position
+                // considering only the right subtree portions of the BBST.
+                position -= lastPosition;
+                // Move right
+                currNode = currNode->right;
+            }
+            else if (position < myPosition)
+            {
+                // Move left - no need to update position
+                currNode = currNode->left;
+            }
+            // Match condition
+            else
+            {
+                BBST_STAT(statsAdd(treeStats.selects));
+                BBST_STAT(statsRecord(treeStats.selectDepth, depth));
+                return currNode;
+            }
+        }
+    }
+    // No BBST exists
+    return NULL;
+}
+
+#ifdef BBST_STATS
+/**
+ * @brief The counters as one line of JSON, with the shape of a tree when one
+ * is given: its height next to the AVL bound 1.44 log2(n + 2) - 0.328 for n
+ * nodes, and its node memory.
+ *
+ * @param root The tree to describe, or NULL for the counters alone.
+ * @return string The JSON object.
+ */
+inline string treeStatsJson(Node *root = NULL)
+{
+    auto histogram = [](const atomic<unsigned long long> *buckets, int size)
+    {
+        int used = size;
+        while (used > 0 && buckets[used - 1].load() == 0)
+        {
+            used--;
+        }
+        string text = "[";
+        for (int i = 0; i < used; i++)
+        {
+            text += (i > 0 ? "," : "") + to_string(buckets[i].load());
+        }
+        return text + "]";
+    };
+
+    string json = "{\"rotations\":{\"left\":" + to_string(treeStats.leftRotations.load()) +
+                  ",\"right\":" + to_string(treeStats.rightRotations.load()) +
+                  ",\"leftLeft\":" + to_string(treeStats.leftLeft.load()) +
+                  ",\"rightRight\":" + to_string(treeStats.rightRight.load()) +
+                  ",\"leftRight\":" + to_string(treeStats.leftRight.load()) +
+                  ",\"rightLeft\":" + to_string(treeStats.rightLeft.load()) + "}";
+    json += ",\"inserts\":" + to_string(treeStats.inserts.load());
+    json += ",\"rotationsPerInsert\":" + histogram(treeStats.rotationsPerInsert, 3);
+    json += ",\"insertPath\":" + histogram(treeStats.insertPath, STATS_BUCKETS);
+    json += ",\"selects\":" + to_string(treeStats.selects.load());
+    json += ",\"selectDepth\":" + histogram(treeStats.selectDepth, STATS_BUCKETS);
+    json += ",\"nodesAllocated\":" + to_string(treeStats.nodesAllocated.load());
+    if (root != NULL)
+    {
+        long long nodes = countNodes(root);
+        char bound[32];
+        snprintf(bound, sizeof(bound), "%.2f", 1.4405 * log2((double)nodes + 2) - 0.3277);
+        json += ",\"tree\":{\"values\":" + to_string(subtreeSize(root)) + ",\"nodes\":" + to_string(nodes) +
+                ",\"height\":" + to_string(height(root)) + ",\"avlBound\":" + bound +
+                ",\"nodeBytes\":" + to_string(nodes * (long long)sizeof(Node)) + "}";
+    }
+    return json + "}";
+}
+#endif
+
+/**
+ * @brief Hints the cache to start loading a node that will be visited soon.
+ */
+inline void prefetchNode(const void *node)
+{
+#if defined(__GNUC__)
+    __builtin_prefetch(node);
+#else
+    (void)node;
+#endif
+}
+
+/**
+ * @brief The number of queries selectBatch() walks down the tree together.
+ */
+const int SELECT_GROUP = 16;
+
+/**
+ * @brief Answers many select queries at once, interleaving their descents.
+ *
+ * One select is a chain of dependent cache misses, one per level. Here up
+ * to SELECT_GROUP queries advance in rounds: each round moves every
+ * unfinished query down one level and prefetches its next node, so the
+ * misses of the whole group overlap instead of being paid one after the
+ * other. The answers are the same as select()'s.
+ *
+ * @param positions The positions to select.
+ * @param count The number of positions.
+ * @param root The root node of the BBST.
+ * @param found Receives, for each position, its node or NULL when out of range.
+ */
+inline void selectBatch(const int *positions, int count, Node *root, Node **found)
+{
+    int size = subtreeSize(root);
+    for (int base = 0; base < count; base += SELECT_GROUP)
+    {
+        int group = min(SELECT_GROUP, count - base);
+        Node *cursor[SELECT_GROUP];
+        int remaining[SELECT_GROUP];
+        int active = 0;
+        for (int i = 0; i < group; i++)
+        {
+            remaining[i] = positions[base + i];
+            bool valid = remaining[i] >= 1 && remaining[i] <= size;
+            cursor[i] = valid ? root : NULL;
+            found[base + i] = NULL;
+            active += valid;
+        }
+
+        BBST_STAT(int depth = 0);
+        while (active > 0)
+        {
+            BBST_STAT(depth++);
+            for (int i = 0; i < group; i++)
+            {
+                Node *node = cursor[i];
+                if (node == NULL)
+                {
+                    continue;
+                }
+                int lastPosition = node->numLeftChildren + node->count;
+                if (remaining[i] > lastPosition)
+                {
+                    remaining[i] -= lastPosition;
+                    node = node->right;
+                }
+                else if (remaining[i] <= node->numLeftChildren)
+                {
+                    node = node->left;
+                }
+                else
+                {
+                    BBST_STAT(statsAdd(treeStats.selects));
+                    BBST_STAT(statsRecord(treeStats.selectDepth, depth));
+                    found[base + i] = node;
+                    node = NULL;
+                    active--;
+                }
+                cursor[i] = node;
+                if (node != NULL)
+                {
+                    prefetchNode(node);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Deletes every node of a subtree.
+ *
+ * @param node The root of the subtree.
+ */
+template <typename N>
+inline void deleteTree(N *node)
+{
+    if (node != NULL)
+    {
+        deleteTree(node->left);
+        deleteTree(node->right);
+        delete node;
+    }
+}
+
+/**
+ * @brief Joins two trees around a middle node whose left tree is the taller one.
+ * Walks down the right spine of the left tree to the first subtree no more
+ * than one level taller than the right tree, hangs the middle node there
+ * and rebalances on the way back up.
+ */
+inline Node *joinRight(Node *left, Node *mid, Node *right)
+{
+    if (height(left) <= height(right) + 1)
+    {
+        mid->left = left;
+        mid->right = right;
+        updateNode(mid);
+        return mid;
+    }
+    left->right = joinRight(left->right, mid, right);
+    updateNode(left);
+    return rebalance(left);
+}
+
+/**
+ * @brief Mirror image of joinRight() for a taller right tree.
+ */
+inline Node *joinLeft(Node *left, Node *mid, Node *right)
+{
+    if (height(right) <= height(left) + 1)
+    {
+        mid->left = left;
+        mid->right = right;
+        updateNode(mid);
+        return mid;
+    }
+    right->left = joinLeft(left, mid, right->left);
+    updateNode(right);
+    return rebalance(right);
+}
+
+/**
+ * @brief AVL join: combines two trees and a node, where every value in left is
+ * smaller and every value in right is larger than the node's value.
+ * Takes O(|height(left) - height(right)| + 1) time and keeps the children counts.
+ *
+ * @param left The tree of smaller values.
+ * @param mid The middle node. Its old children are ignored.
+ * @param right The tree of larger values.
+ * @return Node* The root of the joined tree.
+ */
+inline Node *join(Node *left, Node *mid, Node *right)
+{
+    if (height(left) > height(right) + 1)
+    {
+        return joinRight(left, mid, right);
+    }
+    if (height(right) > height(left) + 1)
+    {
+        return joinLeft(left, mid, right);
+    }
+    mid->left = left;
+    mid->right = right;
+    updateNode(mid);
+    return mid;
+}
+
+/**
+ * @brief Unlinks the node holding the largest value of a subtree, without deleting it.
+ * Mirror image of detachMin().
+ */
+inline Node *detachMax(Node *node, Node *&maxNode)
+{
+    if (node->right == NULL)
+    {
+        maxNode = node;
+        return node->left;
+    }
+    node->right = detachMax(node->right, maxNode);
+    updateNode(node);
+    return rebalance(node);
+}
+
+/**
+ * @brief Joins two trees without a middle node; every value in left must be
+ * smaller than every value in right.
+ */
+inline Node *join2(Node *left, Node *right)
+{
+    if (left == NULL)
+    {
+        return right;
+    }
+    Node *maxNode;
+    left = detachMax(left, maxNode);
+    return join(left, maxNode, right);
+}
+
+/**
+ * @brief AVL split: separates a tree into the values below and above a given value.
+ * Takes O(log n) time; the pieces are rebuilt with join() on the way back up.
+ *
+ * @param node The root of the tree to split. The tree is consumed.
+ * @param value The value to split at.
+ * @param less Receives the tree of values < value.
+ * @param greater Receives the tree of values > value.
+ * @return Node* The detached node holding value (with all of its copies), or NULL.
+ */
+inline Node *split(Node *node, int value, Node *&less, Node *&greater)
+{
+    if (node == NULL)
+    {
+        less = greater = NULL;
+        return NULL;
+    }
+
+    Node *left = node->left;
+    Node *right = node->right;
+    if (value < node->value)
+    {
+        Node *found = split(left, value, less, left);
+        greater = join(left, node, right);
+        return found;
+    }
+    if (value > node->value)
+    {
+        Node *found = split(right, value, right, greater);
+        less = join(left, node, right);
+        return found;
+    }
+
+    less = left;
+    greater = right;
+    node->left = node->right = NULL;
+    updateNode(node);
+    return node;
+}
+
+/**
+ * @brief Subtrees smaller than this are combined on the calling thread;
+ * spawning a thread costs more than the work below it.
+ */
+const int PARALLEL_GRAIN = 1 << 14;
+
+/**
+ * @brief Runs two independent tasks, the first on a new thread when
+ * parallel is set and the thread budget is not used up.
+ *
+ * @param threadBudget Levels of nested forking still allowed.
+ */
+template <typename LeftTask, typename RightTask>
+void forkJoin(bool parallel, int threadBudget, LeftTask leftTask, RightTask rightTask)
+{
+    if (parallel && threadBudget > 0)
+    {
+        thread worker(leftTask);
+        rightTask();
+        worker.join();
+    }
+    else
+    {
+        leftTask();
+        rightTask();
+    }
+}
+
+/**
+ * @brief Number of fork levels that keep every hardware thread busy.
+ */
+inline int defaultThreadBudget()
+{
+    int budget = 0;
+    for (unsigned threads = max(thread::hardware_concurrency(), 1u); threads > 1; threads >>= 1)
+    {
+        budget++;
+    }
+    // A little over-decomposition evens out unbalanced splits.
+    return budget + 1;
+}
+
+/**
+ * @brief Join-based union. The copies of a value present in both trees are added up,
+ * so combining per-shard trees counts every sample once.
+ * Both trees are consumed. O(m log(n/m + 1)) work for trees of sizes m <= n,
+ * with the two recursive halves running in parallel.
+ *
+ * @return Node* The root of the union.
+ */
+inline Node *unionTrees(Node *a, Node *b, int threadBudget)
+{
+    if (a == NULL)
+    {
+        return b;
+    }
+    if (b == NULL)
+    {
+        return a;
+    }
+
+    Node *less, *greater;
+    Node *match = split(b, a->value, less, greater);
+    if (match != NULL)
+    {
+        a->count += match->count;
+        delete match;
+    }
+
+    Node *aLeft = a->left, *aRight = a->right;
+    bool parallel = subtreeSize(a) + subtreeSize(less) + subtreeSize(greater) > PARALLEL_GRAIN;
+    forkJoin(
+        parallel, threadBudget,
+        [&]()
+        { aLeft = unionTrees(aLeft, less, threadBudget - 1); },
+        [&]()
+        { aRight = unionTrees(aRight, greater, threadBudget - 1); });
+    return join(aLeft, a, aRight);
+}
+
+/**
+ * @brief Join-based intersection. A value present in both trees keeps the
+ * smaller of its two counts. Both trees are consumed.
+ *
+ * @return Node* The root of the intersection.
+ */
+inline Node *intersectTrees(Node *a, Node *b, int threadBudget)
+{
+    if (a == NULL || b == NULL)
+    {
+        deleteTree(a);
+        deleteTree(b);
+        return NULL;
+    }
+
+    Node *less, *greater;
+    Node *match = split(b, a->value, less, greater);
+
+    Node *aLeft = a->left, *aRight = a->right;
+    bool parallel = subtreeSize(a) + subtreeSize(less) + subtreeSize(greater) > PARALLEL_GRAIN;
+    forkJoin(
+        parallel, threadBudget,
+        [&]()
+        { aLeft = intersectTrees(aLeft, less, threadBudget - 1); },
+        [&]()
+        { aRight = intersectTrees(aRight, greater, threadBudget - 1); });
+
+    if (match == NULL)
+    {
+        delete a;
+        return join2(aLeft, aRight);
+    }
+    a->count = min(a->count, match->count);
+    delete match;
+    return join(aLeft, a, aRight);
+}
+
+/**
+ * @brief Join-based difference a - b. Every copy in b cancels one copy in a.
+ * Both trees are consumed.
+ *
+ * @return Node* The root of the difference.
+ */
+inline Node *differenceTrees(Node *a, Node *b, int threadBudget)
+{
+    if (a == NULL || b == NULL)
+    {
+        deleteTree(b);
+        return a;
+    }
+
+    Node *less, *greater;
+    Node *match = split(b, a->value, less, greater);
+
+    Node *aLeft = a->left, *aRight = a->right;
+    bool parallel = subtreeSize(a) + subtreeSize(less) + subtreeSize(greater) > PARALLEL_GRAIN;
+    forkJoin(
+        parallel, threadBudget,
+        [&]()
+        { aLeft = differenceTrees(aLeft, less, threadBudget - 1); },
+        [&]()
+        { aRight = differenceTrees(aRight, greater, threadBudget - 1); });
+
+    if (match != NULL)
+    {
+        a->count -= min(a->count, match->count);
+        delete match;
+    }
+    if (a->count == 0)
+    {
+        delete a;
+        return join2(aLeft, aRight);
+    }
+    return join(aLeft, a, aRight);
+}
+
+/**
+ * @brief Builds a perfectly balanced tree from distinct sorted values and
+ * their counts, building the two halves in parallel.
+ */
+inline Node *buildBalanced(const int *values, const int *counts, int n, int threadBudget)
+{
+    if (n == 0)
+    {
+        return NULL;
+    }
+    int mid = n / 2;
+    Node *node = newNode(values[mid]);
+    node->count = counts[mid];
+    Node *left, *right;
+    forkJoin(
+        n > PARALLEL_GRAIN, threadBudget,
+        [&]()
+        { left = buildBalanced(values, counts, mid, threadBudget - 1); },
+        [&]()
+        { right = buildBalanced(values + mid + 1, counts + mid + 1, n - mid - 1, threadBudget - 1); });
+    node->left = left;
+    node->right = right;
+    updateNode(node);
+    return node;
+}
+
+/**
+ * @brief Bulk insert of a sorted batch: the batch is built into a balanced
+ * tree in O(m) work and then unioned into the existing tree, instead of
+ * m separate insert() calls.
+ *
+ * @param root The root of the existing tree (consumed).
+ * @param sorted The batch, in non-decreasing order. Repeats become counts.
+ * @return Node* The root of the combined tree.
+ */
+inline Node *insertSorted(Node *root, const vector<int> &sorted, int threadBudget)
+{
+    vector<int> values, counts;
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+        if (!values.empty() && values.back() == sorted[i])
+        {
+            counts.back()++;
+        }
+        else
+        {
+            values.push_back(sorted[i]);
+            counts.push_back(1);
+        }
+    }
+    Node *batch = buildBalanced(values.data(), counts.data(), (int)values.size(), threadBudget);
+    return unionTrees(root, batch, threadBudget);
+}
+
+/**
+ * @brief Bidirectional in-order iterator over every stored value (each copy
+ * of a repeated value in turn), for trees without parent pointers.
+ *
+ * The iterator keeps the explicit stack of nodes from the root down to the
+ * current one. Stepping to a neighbour either descends into a child's
+ * subtree or pops back to an ancestor, so a full pass moves along each edge
+ * twice and costs O(1) amortized per value; walking k values from any
+ * starting point is O(k + log n). The tree must not change while an
+ * iterator is in use.
+ */
+class TreeIterator
+{
+public:
+    TreeIterator(Node *root) : root(root), copy(0), position(0) {}
+
+    /**
+     * @brief Move to the position-th smallest value.
+     *
+     * @return bool False, leaving the iterator invalid, when out of range.
+     */
+    bool seekRank(int position)
+    {
+        path.clear();
+        if (position < 1 || position > subtreeSize(root))
+        {
+            return false;
+        }
+        this->position = position;
+        Node *node = root;
+        while (true)
+        {
+            path.push_back(node);
+            if (position <= node->numLeftChildren)
+            {
+                node = node->left;
+            }
+            else if (position > node->numLeftChildren + node->count)
+            {
+                position -= node->numLeftChildren + node->count;
+                node = node->right;
+            }
+            else
+            {
+                copy = position - node->numLeftChildren - 1;
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief Move to the first copy of the smallest value >= key.
+     *
+     * @return bool False, leaving the iterator invalid, when every value is smaller.
+     */
+    bool seekKey(int key)
+    {
+        int rank = countLess(key, root);
+        return seekRank(rank + 1);
+    }
+
+    bool valid() const { return !path.empty(); }
+    int value() const { return path.back()->value; }
+
+    // The 1-based rank of the current value.
+    int rank() const { return position; }
+
+    void next()
+    {
+        position++;
+        Node *node = path.back();
+        if (++copy < node->count)
+        {
+            return;
+        }
+        copy = 0;
+        if (node->right != NULL)
+        {
+            path.push_back(node->right);
+            while (path.back()->left != NULL)
+            {
+                path.push_back(path.back()->left);
+            }
+            return;
+        }
+        // Climb until we leave a left subtree; its parent is next.
+        path.pop_back();
+        while (!path.empty() && path.back()->right == node)
+        {
+            node = path.back();
+            path.pop_back();
+        }
+    }
+
+    void prev()
+    {
+        position--;
+        Node *node = path.back();
+        if (copy > 0)
+        {
+            copy--;
+            return;
+        }
+        if (node->left != NULL)
+        {
+            path.push_back(node->left);
+            while (path.back()->right != NULL)
+            {
+                path.push_back(path.back()->right);
+            }
+            copy = path.back()->count - 1;
+            return;
+        }
+        path.pop_back();
+        while (!path.empty() && path.back()->left == node)
+        {
+            node = path.back();
+            path.pop_back();
+        }
+        if (!path.empty())
+        {
+            copy = path.back()->count - 1;
+        }
+    }
+
+private:
+    Node *root;
+    vector<Node *> path;
+    int copy;
+    int position;
+};
+
+/**
+ * @brief Streams the values of ranks first..last (1-based, clamped to the
+ * tree) to a callback, in order, one call per copy.
+ */
+template <typename Visit>
+void scanByRank(Node *root, int first, int last, Visit visit)
+{
+    TreeIterator it(root);
+    last = min(last, subtreeSize(root));
+    for (it.seekRank(max(first, 1)); it.valid() && it.rank() <= last; it.next())
+    {
+        visit(it.value());
+    }
+}
+
+/**
+ * @brief Streams the values in [low, high] to a callback, in order, one call per copy.
+ */
+template <typename Visit>
+void scanByKey(Node *root, int low, int high, Visit visit)
+{
+    TreeIterator it(root);
+    for (it.seekKey(low); it.valid() && it.value() <= high; it.next())
+    {
+        visit(it.value());
+    }
+}
+
+/**
+ * @brief Thin object wrapper around the AVL functions above, so the tree
+ * can be used interchangeably with the other order-statistic indexes.
+ *
+ * Every index exposes the same operations:
+ *   insert(x), erase(x), select(k, out), getRank(x), countLess(x),
+ *   countRange(lo, hi) and size().
+ */
+class AVLTree
+{
+public:
+    AVLTree() : root(NULL) {}
+    ~AVLTree() { deleteTree(root); }
+    AVLTree(const AVLTree &) = delete;
+    AVLTree &operator=(const AVLTree &) = delete;
+
+    void insert(int value) { root = ::insert(root, value); }
+    void erase(int value) { root = ::erase(root, value); }
+    int getRank(int value) const { return ::getRank(value, root); }
+    int countLess(int value) const { return ::countLess(value, root); }
+    int countRange(int low, int high) const { return ::countRange(low, high, root); }
+    int size() const { return subtreeSize(root); }
+
+    bool select(int position, int &value) const
+    {
+        Node *found = ::select(position, root);
+        if (found == NULL)
+        {
+            return false;
+        }
+        value = found->value;
+        return true;
+    }
+
+    Node *getRoot() const { return root; }
+
+    // In-order scans; see TreeIterator.
+    template <typename Visit>
+    void scanByRank(int first, int last, Visit visit) const { ::scanByRank(root, first, last, visit); }
+    template <typename Visit>
+    void scanByKey(int low, int high, Visit visit) const { ::scanByKey(root, low, high, visit); }
+
+    // Bulk operations; the other tree is emptied.
+    void unionWith(AVLTree &other) { root = unionTrees(root, other.release(), defaultThreadBudget()); }
+    void intersectWith(AVLTree &other) { root = intersectTrees(root, other.release(), defaultThreadBudget()); }
+    void subtract(AVLTree &other) { root = differenceTrees(root, other.release(), defaultThreadBudget()); }
+    void insertSorted(const vector<int> &sorted) { root = ::insertSorted(root, sorted, defaultThreadBudget()); }
+
+private:
+    Node *release()
+    {
+        Node *detached = root;
+        root = NULL;
+        return detached;
+    }
+
+    Node *root;
+};
+
+/**
+ * @brief AVL tree whose insert starts from a finger: the path of the
+ * previous insertion.
+ *
+ * Every node on the path is kept with the open interval of values its
+ * subtree can hold. An insert climbs the path only as far as the first
+ * ancestor whose interval contains the new value, then descends from there,
+ * so a value next to the previous one (timestamps, ids) is found in O(1)
+ * steps instead of O(log n) steps from the root. The climb and descent are
+ * iterative; the finger is the explicit path, since nodes have no parent
+ * pointers.
+ *
+ * The way back up stops at the first node whose height does not change, or
+ * after the one rotation an insertion needs, so it is amortized O(1) too.
+ * The children counts of the finger's nodes above the climb are not touched
+ * either: each step keeps the number of values added below it that its
+ * ancestors do not count yet, moved up one step whenever the climb leaves
+ * it, and settle() adds them in before anything reads the counts (queries,
+ * erase, getRoot()). Erase and the queries are the plain AVL ones; erase
+ * drops the finger.
+ */
+class FingerTree
+{
+public:
+    FingerTree() : root(NULL) {}
+    ~FingerTree() { deleteTree(root); }
+    FingerTree(const FingerTree &) = delete;
+    FingerTree &operator=(const FingerTree &) = delete;
+
+    void insert(int value)
+    {
+        if (root == NULL)
+        {
+            root = newNode(value);
+            path.assign(1, Step{root, LLONG_MIN, LLONG_MAX, 0});
+            return;
+        }
+
+        // Up: the deepest finger node whose subtree can hold the value.
+        // The root holds everything, so the climb always stops.
+        if (path.empty())
+        {
+            path.push_back(Step{root, LLONG_MIN, LLONG_MAX, 0});
+        }
+        while (!(path.back().low < value && value < path.back().high))
+        {
+            popStep();
+        }
+
+        // Down: to the node holding the value, or a new leaf. The ancestors
+        // of the climb's end owe the new value.
+        int top = (int)path.size() - 1;
+        path[top].pending++;
+        if (!descend(value, true))
+        {
+            return;
+        }
+
+        // Back up, while the height grows. An insertion needs at most one
+        // (single or double) rotation, which restores the old height.
+        for (int d = (int)path.size() - 2; d >= 0; d--)
+        {
+            if (d < top)
+            {
+                // Above the climb the counts are owed; settle this one first.
+                addPending(d + 1);
+            }
+            Node *node = path[d].node;
+            int oldHeight = node->height;
+            node->height = max(height(node->left), height(node->right)) + 1;
+            int balance = getBalance(node);
+            if (balance > 1 || balance < -1)
+            {
+                Node *rotated = rebalance(node);
+                if (d == 0)
+                {
+                    root = rotated;
+                }
+                else if (path[d - 1].node->left == node)
+                {
+                    path[d - 1].node->left = rotated;
+                }
+                else
+                {
+                    path[d - 1].node->right = rotated;
+                }
+                // The path below the rotation is rebuilt.
+                path[d].node = rotated;
+                path.resize(d + 1);
+                descend(value, false);
+                return;
+            }
+            if (node->height == oldHeight)
+            {
+                return;
+            }
+        }
+    }
+
+    void erase(int value)
+    {
+        settle();
+        root = ::erase(root, value);
+        path.clear();
+    }
+
+    int getRank(int value) const
+    {
+        settle();
+        return ::getRank(value, root);
+    }
+    int countLess(int value) const
+    {
+        settle();
+        return ::countLess(value, root);
+    }
+    int countRange(int low, int high) const
+    {
+        settle();
+        return ::countRange(low, high, root);
+    }
+    int size() const
+    {
+        settle();
+        return subtreeSize(root);
+    }
+
+    bool select(int position, int &value) const
+    {
+        settle();
+        Node *found = ::select(position, root);
+        if (found == NULL)
+        {
+            return false;
+        }
+        value = found->value;
+        return true;
+    }
+
+    Node *getRoot() const
+    {
+        settle();
+        return root;
+    }
+
+private:
+    // A finger node, the open interval (low, high) of values its subtree
+    // holds, and the values added to that subtree its ancestors do not count yet.
+    struct Step
+    {
+        Node *node;
+        long long low, high;
+        int pending;
+    };
+
+    // Counts a step's pending values in its parent step's node, and hands
+    // them on to the parent's ancestors.
+    void addPending(size_t d) const
+    {
+        Step &step = path[d];
+        if (step.pending != 0)
+        {
+            Node *parent = path[d - 1].node;
+            (parent->left == step.node ? parent->numLeftChildren : parent->numRightChildren) += step.pending;
+            path[d - 1].pending += step.pending;
+            step.pending = 0;
+        }
+    }
+
+    void popStep()
+    {
+        addPending(path.size() - 1);
+        path.pop_back();
+    }
+
+    // Brings every count on the finger up to date, O(path length).
+    void settle() const
+    {
+        for (size_t d = path.size(); d-- > 1;)
+        {
+            addPending(d);
+        }
+        if (!path.empty())
+        {
+            path[0].pending = 0;
+        }
+    }
+
+    // Extends the path from its last node down to the value's node. With
+    // add, the value is inserted there: one more copy, or a new leaf, and
+    // each node passed counts it. Returns whether a leaf was created.
+    bool descend(int value, bool add)
+    {
+        while (true)
+        {
+            Step step = path.back();
+            Node *node = step.node;
+            if (value == node->value)
+            {
+                node->count += add;
+                return false;
+            }
+            bool goLeft = value < node->value;
+            (goLeft ? node->numLeftChildren : node->numRightChildren) += add;
+            Node *&child = goLeft ? node->left : node->right;
+            bool created = child == NULL;
+            if (created)
+            {
+                child = newNode(value);
+            }
+            path.push_back(Step{child, goLeft ? step.low : (long long)node->value,
+                                goLeft ? (long long)node->value : step.high, 0});
+            if (created)
+            {
+                return true;
+            }
+        }
+    }
+
+    Node *root;
+    // Mutable: settle() runs in the const queries.
+    mutable vector<Step> path;
+};
+
+#endif
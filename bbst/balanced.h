@@ -0,0 +1,631 @@
+/**
+ * @file balanced.h
+ * @brief Alternative balancing schemes: treap, red-black and
+ * weight-balanced trees.
+ */
+
+#ifndef BBST_BALANCED_H
+#define BBST_BALANCED_H
+
+#include "common.h"
+
+/**
+ * @brief Node of the alternative balanced trees below. Like Node it keeps a
+ * count per distinct value, and size is the number of values (copies) in
+ * the subtree. balance is the scheme's own balance information: the heap
+ * priority in the treap, the color in the red-black tree, and the number of
+ * nodes in the subtree in the weight-balanced tree.
+ */
+struct RankedNode
+{
+    int value;
+    int count;
+    int size;
+    int balance;
+    RankedNode *left, *right;
+};
+
+inline int rankedSize(const RankedNode *node)
+{
+    return node == NULL ? 0 : node->size;
+}
+
+/**
+ * @brief The select walk shared by the RankedNode trees.
+ *
+ * @return RankedNode* The node holding the position-th smallest value, or NULL when out of range.
+ */
+inline RankedNode *rankedSelect(RankedNode *node, int position)
+{
+    if (position < 1 || position > rankedSize(node))
+    {
+        return NULL;
+    }
+    while (true)
+    {
+        int leftSize = rankedSize(node->left);
+        if (position <= leftSize)
+        {
+            node = node->left;
+        }
+        else if (position > leftSize + node->count)
+        {
+            position -= leftSize + node->count;
+            node = node->right;
+        }
+        else
+        {
+            return node;
+        }
+    }
+}
+
+/**
+ * @brief The number of values below value (or up to it, when inclusive).
+ */
+inline int rankedCount(const RankedNode *node, int value, bool inclusive)
+{
+    int rank = 0;
+    while (node != NULL)
+    {
+        if (value < node->value || (!inclusive && value == node->value))
+        {
+            node = node->left;
+        }
+        else
+        {
+            rank += rankedSize(node->left) + node->count;
+            node = node->right;
+        }
+    }
+    return rank;
+}
+
+inline void deleteRanked(RankedNode *node)
+{
+    if (node != NULL)
+    {
+        deleteRanked(node->left);
+        deleteRanked(node->right);
+        delete node;
+    }
+}
+
+/**
+ * @brief The queries every RankedNode tree answers the same way, given its root.
+ */
+class RankedTreeBase
+{
+public:
+    RankedTreeBase() : root(NULL), rotations(0) {}
+    ~RankedTreeBase() { deleteRanked(root); }
+    RankedTreeBase(const RankedTreeBase &) = delete;
+    RankedTreeBase &operator=(const RankedTreeBase &) = delete;
+
+    int getRank(int value) const { return rankedCount(root, value, true); }
+    int countLess(int value) const { return rankedCount(root, value, false); }
+    int countRange(int low, int high) const { return low > high ? 0 : getRank(high) - countLess(low); }
+    int size() const { return rankedSize(root); }
+    const RankedNode *getRoot() const { return root; }
+    // The rotations made so far, for comparing the balancing schemes.
+    unsigned long long rotationCount() const { return rotations; }
+
+    bool select(int position, int &value) const
+    {
+        RankedNode *found = rankedSelect(root, position);
+        if (found == NULL)
+        {
+            return false;
+        }
+        value = found->value;
+        return true;
+    }
+
+protected:
+    static RankedNode *makeNode(int value, int balance)
+    {
+        RankedNode *node = new RankedNode();
+        node->value = value;
+        node->count = 1;
+        node->size = 1;
+        node->balance = balance;
+        node->left = NULL;
+        node->right = NULL;
+        return node;
+    }
+
+    RankedNode *root;
+    unsigned long long rotations;
+};
+
+/**
+ * @brief Randomized treap: a search tree on the values that is a max-heap on
+ * random priorities, so its shape is that of a random insertion order and
+ * the expected depth is O(log n) whatever the input order. Inserts rotate
+ * the new leaf up while its priority beats its parent's (O(1) rotations
+ * expected); erase merges the node's two subtrees in its place.
+ */
+class TreapTree : public RankedTreeBase
+{
+public:
+    TreapTree() : generator(2022) {}
+
+    void insert(int value) { root = insert(root, value); }
+    void erase(int value) { root = erase(root, value); }
+
+private:
+    static void pull(RankedNode *node) { node->size = rankedSize(node->left) + rankedSize(node->right) + node->count; }
+
+    RankedNode *rotateRight(RankedNode *node)
+    {
+        rotations++;
+        RankedNode *pivot = node->left;
+        node->left = pivot->right;
+        pivot->right = node;
+        pull(node);
+        pull(pivot);
+        return pivot;
+    }
+
+    RankedNode *rotateLeft(RankedNode *node)
+    {
+        rotations++;
+        RankedNode *pivot = node->right;
+        node->right = pivot->left;
+        pivot->left = node;
+        pull(node);
+        pull(pivot);
+        return pivot;
+    }
+
+    RankedNode *insert(RankedNode *node, int value)
+    {
+        if (node == NULL)
+        {
+            return makeNode(value, (int)(generator() >> 1));
+        }
+        if (value < node->value)
+        {
+            node->left = insert(node->left, value);
+            if (node->left->balance > node->balance)
+            {
+                return rotateRight(node);
+            }
+        }
+        else if (value > node->value)
+        {
+            node->right = insert(node->right, value);
+            if (node->right->balance > node->balance)
+            {
+                return rotateLeft(node);
+            }
+        }
+        else
+        {
+            node->count++;
+        }
+        pull(node);
+        return node;
+    }
+
+    // Joins two treaps whose values are all smaller in the first.
+    static RankedNode *merge(RankedNode *left, RankedNode *right)
+    {
+        if (left == NULL || right == NULL)
+        {
+            return left != NULL ? left : right;
+        }
+        if (left->balance > right->balance)
+        {
+            left->right = merge(left->right, right);
+            pull(left);
+            return left;
+        }
+        right->left = merge(left, right->left);
+        pull(right);
+        return right;
+    }
+
+    static RankedNode *erase(RankedNode *node, int value)
+    {
+        if (node == NULL)
+        {
+            return NULL;
+        }
+        if (value < node->value)
+        {
+            node->left = erase(node->left, value);
+        }
+        else if (value > node->value)
+        {
+            node->right = erase(node->right, value);
+        }
+        else if (node->count > 1)
+        {
+            node->count--;
+        }
+        else
+        {
+            RankedNode *merged = merge(node->left, node->right);
+            delete node;
+            return merged;
+        }
+        pull(node);
+        return node;
+    }
+
+    mt19937 generator;
+};
+
+/**
+ * @brief Red-black tree (the classic bottom-up algorithms of Cormen et al.):
+ * every red node has black children and every path down from a node passes
+ * the same number of black nodes, so the height is at most 2 log n, looser
+ * than AVL's 1.44 log n. Updates are one descent that fixes the sizes on the
+ * way down, then a recoloring walk back up the recorded path that ends in at
+ * most two rotations for an insert and three for an erase. balance is 1 for
+ * a red node.
+ */
+class RedBlackTree : public RankedTreeBase
+{
+public:
+    void insert(int value)
+    {
+        RankedNode *path[MAX_DEPTH];
+        int depth = 0;
+        // Every node on the way down gains one value.
+        for (RankedNode *node = root; node != NULL;)
+        {
+            node->size++;
+            if (value == node->value)
+            {
+                node->count++;
+                return;
+            }
+            path[depth++] = node;
+            node = value < node->value ? node->left : node->right;
+        }
+
+        RankedNode *node = makeNode(value, RED);
+        replaceChild(depth > 0 ? path[depth - 1] : NULL, NULL, node, value);
+        // path[depth - 1] is the parent of node; a red parent is never the root.
+        while (depth >= 2 && isRed(path[depth - 1]))
+        {
+            RankedNode *parent = path[depth - 1], *grand = path[depth - 2];
+            RankedNode *uncle = parent == grand->left ? grand->right : grand->left;
+            if (isRed(uncle))
+            {
+                parent->balance = BLACK;
+                uncle->balance = BLACK;
+                grand->balance = RED;
+                node = grand;
+                depth -= 2;
+                continue;
+            }
+            RankedNode *top;
+            if (parent == grand->left)
+            {
+                if (node == parent->right)
+                {
+                    grand->left = rotateLeft(parent);
+                }
+                top = rotateRight(grand);
+            }
+            else
+            {
+                if (node == parent->left)
+                {
+                    grand->right = rotateRight(parent);
+                }
+                top = rotateLeft(grand);
+            }
+            top->balance = BLACK;
+            grand->balance = RED;
+            replaceChild(depth >= 3 ? path[depth - 3] : NULL, grand, top, 0);
+            break;
+        }
+        root->balance = BLACK;
+    }
+
+    void erase(int value)
+    {
+        RankedNode *path[MAX_DEPTH];
+        int depth = 0;
+        RankedNode *node = root;
+        // Every node on the way down loses one value, undone if it is missing.
+        while (node != NULL && node->value != value)
+        {
+            node->size--;
+            path[depth++] = node;
+            node = value < node->value ? node->left : node->right;
+        }
+        if (node == NULL)
+        {
+            for (int i = 0; i < depth; i++)
+            {
+                path[i]->size++;
+            }
+            return;
+        }
+        node->size--;
+        // Extra copies go without changing the shape.
+        if (node->count > 1)
+        {
+            node->count--;
+            return;
+        }
+
+        if (node->left != NULL && node->right != NULL)
+        {
+            // Take over the successor's copies and unlink its node instead;
+            // they leave every subtree between the two nodes.
+            path[depth++] = node;
+            int below = depth;
+            RankedNode *successor = node->right;
+            while (successor->left != NULL)
+            {
+                path[depth++] = successor;
+                successor = successor->left;
+            }
+            for (int i = below; i < depth; i++)
+            {
+                path[i]->size -= successor->count;
+            }
+            node->value = successor->value;
+            node->count = successor->count;
+            node = successor;
+        }
+
+        RankedNode *child = node->left != NULL ? node->left : node->right;
+        replaceChild(depth > 0 ? path[depth - 1] : NULL, node, child, 0);
+        bool removedBlack = !isRed(node);
+        delete node;
+        if (removedBlack)
+        {
+            eraseFixUp(child, path, depth);
+        }
+    }
+
+private:
+    static const int BLACK = 0, RED = 1;
+    // Enough for the 2 log2(n + 1) height at any int size, plus the node a
+    // rotation in eraseFixUp() pushes.
+    static const int MAX_DEPTH = 72;
+
+    static bool isRed(const RankedNode *node) { return node != NULL && node->balance == RED; }
+    static void pull(RankedNode *node) { node->size = rankedSize(node->left) + rankedSize(node->right) + node->count; }
+
+    RankedNode *rotateLeft(RankedNode *node)
+    {
+        rotations++;
+        RankedNode *pivot = node->right;
+        node->right = pivot->left;
+        pivot->left = node;
+        pull(node);
+        pull(pivot);
+        return pivot;
+    }
+
+    RankedNode *rotateRight(RankedNode *node)
+    {
+        rotations++;
+        RankedNode *pivot = node->left;
+        node->left = pivot->right;
+        pivot->right = node;
+        pull(node);
+        pull(pivot);
+        return pivot;
+    }
+
+    // Puts replacement where child was under parent (the root for NULL).
+    // A new leaf (child NULL) goes on the side value belongs to.
+    void replaceChild(RankedNode *parent, RankedNode *child, RankedNode *replacement, int value)
+    {
+        if (parent == NULL)
+        {
+            root = replacement;
+        }
+        else if (child != NULL ? parent->left == child : value < parent->value)
+        {
+            parent->left = replacement;
+        }
+        else
+        {
+            parent->right = replacement;
+        }
+    }
+
+    // Restores the black heights after a black node was unlinked. node took
+    // its place (and may be NULL); path[0, depth) are node's ancestors.
+    void eraseFixUp(RankedNode *node, RankedNode **path, int depth)
+    {
+        while (depth > 0 && !isRed(node))
+        {
+            RankedNode *parent = path[depth - 1];
+            bool onLeft = parent->left == node;
+            // The sibling's side is one black node deeper, so it exists.
+            RankedNode *sibling = onLeft ? parent->right : parent->left;
+            if (isRed(sibling))
+            {
+                sibling->balance = BLACK;
+                parent->balance = RED;
+                replaceChild(depth >= 2 ? path[depth - 2] : NULL, parent,
+                             onLeft ? rotateLeft(parent) : rotateRight(parent), 0);
+                path[depth - 1] = sibling;
+                path[depth++] = parent;
+                sibling = onLeft ? parent->right : parent->left;
+            }
+            RankedNode *nearNephew = onLeft ? sibling->left : sibling->right;
+            RankedNode *farNephew = onLeft ? sibling->right : sibling->left;
+            if (!isRed(nearNephew) && !isRed(farNephew))
+            {
+                // Push the missing black up a level.
+                sibling->balance = RED;
+                node = parent;
+                depth--;
+                continue;
+            }
+            if (!isRed(farNephew))
+            {
+                nearNephew->balance = BLACK;
+                sibling->balance = RED;
+                sibling = onLeft ? (parent->right = rotateRight(sibling)) : (parent->left = rotateLeft(sibling));
+                farNephew = onLeft ? sibling->right : sibling->left;
+            }
+            sibling->balance = parent->balance;
+            parent->balance = BLACK;
+            farNephew->balance = BLACK;
+            replaceChild(depth >= 2 ? path[depth - 2] : NULL, parent,
+                         onLeft ? rotateLeft(parent) : rotateRight(parent), 0);
+            return;
+        }
+        if (node != NULL)
+        {
+            node->balance = BLACK;
+        }
+    }
+};
+
+/**
+ * @brief Weight-balanced tree (BB[alpha], with the parameters 3 and 2 of
+ * Hirai and Yamamoto). A node is balanced while neither subtree has more
+ * than 3 times the weight (nodes + 1) of the other; the node counts needed
+ * for that sit next to the value counts select uses, so balancing costs no
+ * heights. Rotations happen less often than in AVL as the tree grows, and
+ * the same sizes make it natural for split and join.
+ */
+class WeightBalancedTree : public RankedTreeBase
+{
+public:
+    void insert(int value) { root = insert(root, value); }
+    void erase(int value) { root = erase(root, value); }
+
+private:
+    static const int DELTA = 3, GAMMA = 2;
+
+    static int weight(const RankedNode *node) { return (node == NULL ? 0 : node->balance) + 1; }
+
+    static void pull(RankedNode *node)
+    {
+        node->size = rankedSize(node->left) + rankedSize(node->right) + node->count;
+        node->balance = weight(node->left) + weight(node->right) - 1;
+    }
+
+    RankedNode *rotateLeft(RankedNode *node)
+    {
+        rotations++;
+        RankedNode *pivot = node->right;
+        node->right = pivot->left;
+        pivot->left = node;
+        pull(node);
+        pull(pivot);
+        return pivot;
+    }
+
+    RankedNode *rotateRight(RankedNode *node)
+    {
+        rotations++;
+        RankedNode *pivot = node->left;
+        node->left = pivot->right;
+        pivot->right = node;
+        pull(node);
+        pull(pivot);
+        return pivot;
+    }
+
+    // Restores the weight balance at a node after one update below it.
+    RankedNode *rebalance(RankedNode *node)
+    {
+        pull(node);
+        if (weight(node->right) > DELTA * weight(node->left))
+        {
+            if (weight(node->right->left) >= GAMMA * weight(node->right->right))
+            {
+                node->right = rotateRight(node->right);
+            }
+            return rotateLeft(node);
+        }
+        if (weight(node->left) > DELTA * weight(node->right))
+        {
+            if (weight(node->left->right) >= GAMMA * weight(node->left->left))
+            {
+                node->left = rotateLeft(node->left);
+            }
+            return rotateRight(node);
+        }
+        return node;
+    }
+
+    RankedNode *insert(RankedNode *node, int value)
+    {
+        if (node == NULL)
+        {
+            return makeNode(value, 1);
+        }
+        if (value < node->value)
+        {
+            node->left = insert(node->left, value);
+        }
+        else if (value > node->value)
+        {
+            node->right = insert(node->right, value);
+        }
+        else
+        {
+            node->count++;
+            node->size++;
+            return node;
+        }
+        return rebalance(node);
+    }
+
+    RankedNode *detachMin(RankedNode *node, RankedNode *&minNode)
+    {
+        if (node->left == NULL)
+        {
+            minNode = node;
+            return node->right;
+        }
+        node->left = detachMin(node->left, minNode);
+        return rebalance(node);
+    }
+
+    RankedNode *erase(RankedNode *node, int value)
+    {
+        if (node == NULL)
+        {
+            return NULL;
+        }
+        if (value < node->value)
+        {
+            node->left = erase(node->left, value);
+        }
+        else if (value > node->value)
+        {
+            node->right = erase(node->right, value);
+        }
+        else if (node->count > 1)
+        {
+            node->count--;
+            node->size--;
+            return node;
+        }
+        else
+        {
+            if (node->left == NULL || node->right == NULL)
+            {
+                RankedNode *child = node->left != NULL ? node->left : node->right;
+                delete node;
+                return child;
+            }
+            RankedNode *successor;
+            node->right = detachMin(node->right, successor);
+            node->value = successor->value;
+            node->count = successor->count;
+            delete successor;
+        }
+        return rebalance(node);
+    }
+};
+
+#endif
@@ -0,0 +1,579 @@
+/**
+ * @file bplus.h
+ * @brief Counted B+-tree with cache line sized nodes.
+ */
+
+#ifndef BBST_BPLUS_H
+#define BBST_BPLUS_H
+
+#include "common.h"
+
+/**
+ * @brief Number of leading entries of a sorted 16 slot array that are <= value.
+ * Compares all 16 slots at once with SSE2 when available; slots past
+ * validCount are masked out, so their contents do not matter.
+ *
+ * @param slots A 16 entry array, sorted over its first validCount entries.
+ * @param value The value to compare against.
+ * @param validCount The number of meaningful entries (0 to 16).
+ * @return int The number of entries <= value.
+ */
+inline int countLessEqual16(const int *slots, int value, int validCount)
+{
+#ifdef __SSE2__
+    __m128i key = _mm_set1_epi32(value);
+    unsigned greaterMask = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        __m128i lanes = _mm_loadu_si128((const __m128i *)(slots + 4 * i));
+        __m128i greater = _mm_cmpgt_epi32(lanes, key);
+        greaterMask |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(greater)) << (4 * i);
+    }
+    unsigned validMask = (1u << validCount) - 1;
+    return __builtin_popcount(~greaterMask & validMask);
+#else
+    int count = 0;
+    while (count < validCount && slots[count] <= value)
+    {
+        count++;
+    }
+    return count;
+#endif
+}
+
+/**
+ * @brief Number of leading entries of a sorted 16 slot array that are < value.
+ * See countLessEqual16().
+ */
+inline int countLess16(const int *slots, int value, int validCount)
+{
+#ifdef __SSE2__
+    __m128i key = _mm_set1_epi32(value);
+    unsigned lessMask = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        __m128i lanes = _mm_loadu_si128((const __m128i *)(slots + 4 * i));
+        __m128i less = _mm_cmplt_epi32(lanes, key);
+        lessMask |= (unsigned)_mm_movemask_ps(_mm_castsi128_ps(less)) << (4 * i);
+    }
+    unsigned validMask = (1u << validCount) - 1;
+    return __builtin_popcount(lessMask & validMask);
+#else
+    int count = 0;
+    while (count < validCount && slots[count] < value)
+    {
+        count++;
+    }
+    return count;
+#endif
+}
+
+/**
+ * @brief Counted B+-tree order-statistic index.
+ *
+ * An AVL select touches one node (one cache miss) per level, roughly 27 levels
+ * for 10^8 keys. Here every node holds up to 16 entries, so the tree is about
+ * log16(n) levels deep. The keys of a node fill exactly one 64 byte cache line
+ * and are searched with a single SIMD pass; inner nodes additionally keep the
+ * prefix sums of their children's subtree sizes in a second cache line, so
+ * picking the child that holds the k-th value is the same SIMD count.
+ *
+ * Values live only in the leaves. Inner node separator keys[i] is a lower bound
+ * for every value under children[i + 1] and an exclusive upper bound for
+ * everything under children[i]. Like the AVL tree, a leaf stores each distinct
+ * value once with its number of copies, and all sizes count every copy.
+ */
+class BPlusTree
+{
+public:
+    static constexpr int FANOUT = 16;
+    // Nodes below this many entries are merged with or refilled from a sibling.
+    static constexpr int MIN_FILL = 5;
+
+    BPlusTree() : root(new Leaf()), height(0) {}
+    ~BPlusTree() { destroy(root, height); }
+    BPlusTree(const BPlusTree &) = delete;
+    BPlusTree &operator=(const BPlusTree &) = delete;
+
+    void insert(int value)
+    {
+        Split split;
+        insertInto(root, height, value, split);
+        if (split.right == NULL)
+        {
+            return;
+        }
+
+        // The root split: grow the tree by one level.
+        Inner *newRoot = new Inner();
+        newRoot->count = 2;
+        newRoot->keys[0] = split.separator;
+        newRoot->children[0] = root;
+        newRoot->children[1] = split.right;
+        newRoot->cumulative[0] = split.leftSize;
+        newRoot->cumulative[1] = split.leftSize + split.rightSize;
+        root = newRoot;
+        height++;
+    }
+
+    void erase(int value)
+    {
+        if (!eraseFrom(root, height, value))
+        {
+            return;
+        }
+
+        // An inner root left with a single child is replaced by that child.
+        if (height > 0 && ((Inner *)root)->count == 1)
+        {
+            Inner *oldRoot = (Inner *)root;
+            root = oldRoot->children[0];
+            delete oldRoot;
+            height--;
+        }
+    }
+
+    bool select(int position, int &value) const
+    {
+        if (position < 1 || position > size())
+        {
+            return false;
+        }
+
+        void *node = root;
+        for (int level = height; level > 0; level--)
+        {
+            Inner *inner = (Inner *)node;
+            // First child whose prefix sum reaches the position.
+            int child = countLess16(inner->cumulative, position, inner->count);
+            if (child > 0)
+            {
+                position -= inner->cumulative[child - 1];
+            }
+            node = inner->children[child];
+        }
+        const Leaf *leaf = (const Leaf *)node;
+        int entry = 0;
+        while (position > leaf->copies[entry])
+        {
+            position -= leaf->copies[entry];
+            entry++;
+        }
+        value = leaf->keys[entry];
+        return true;
+    }
+
+    int getRank(int value) const
+    {
+        int count = 0;
+        const Leaf *leaf = descend(value, count);
+        return count + copiesBefore(leaf, countLessEqual16(leaf->keys, value, leaf->count));
+    }
+
+    int countLess(int value) const
+    {
+        int count = 0;
+        const Leaf *leaf = descend(value, count);
+        return count + copiesBefore(leaf, countLess16(leaf->keys, value, leaf->count));
+    }
+
+    int countRange(int low, int high) const
+    {
+        if (low > high)
+        {
+            return 0;
+        }
+        return getRank(high) - countLess(low);
+    }
+
+    int size() const { return subtreeTotal(root, height); }
+
+private:
+    struct alignas(64) Leaf
+    {
+        int keys[FANOUT];   // Distinct values, one cache line.
+        int copies[FANOUT]; // Multiplicity of each value.
+        int count = 0;      // Number of distinct values.
+        int total = 0;      // Sum of the multiplicities.
+    };
+
+    struct alignas(64) Inner
+    {
+        int keys[FANOUT];       // FANOUT - 1 separators, one cache line.
+        int cumulative[FANOUT]; // Prefix sums of the children's sizes.
+        void *children[FANOUT];
+        int count = 0;          // Number of children.
+    };
+
+    // Result of a node split, to be linked into the parent.
+    struct Split
+    {
+        void *right = NULL;
+        int separator = 0;
+        int leftSize = 0;
+        int rightSize = 0;
+    };
+
+    static int subtreeTotal(const void *node, int level)
+    {
+        if (level == 0)
+        {
+            return ((const Leaf *)node)->total;
+        }
+        const Inner *inner = (const Inner *)node;
+        return inner->cumulative[inner->count - 1];
+    }
+
+    // Number of copies held by the first entries of a leaf.
+    static int copiesBefore(const Leaf *leaf, int entries)
+    {
+        int count = 0;
+        for (int i = 0; i < entries; i++)
+        {
+            count += leaf->copies[i];
+        }
+        return count;
+    }
+
+    // Fill a leaf with entries of parallel key and copy arrays.
+    static void fillLeaf(Leaf *leaf, const int *keys, const int *copies, int entries)
+    {
+        memcpy(leaf->keys, keys, entries * sizeof(int));
+        memcpy(leaf->copies, copies, entries * sizeof(int));
+        leaf->count = entries;
+        leaf->total = copiesBefore(leaf, entries);
+    }
+
+    // Index of the child whose key range holds value.
+    static int route(const Inner *inner, int value)
+    {
+        return countLessEqual16(inner->keys, value, inner->count - 1);
+    }
+
+    // Rebuild the prefix sums from per-child sizes.
+    static void setCumulative(Inner *inner, const int *sizes)
+    {
+        int total = 0;
+        for (int i = 0; i < inner->count; i++)
+        {
+            total += sizes[i];
+            inner->cumulative[i] = total;
+        }
+    }
+
+    static void getSizes(const Inner *inner, int *sizes)
+    {
+        for (int i = 0; i < inner->count; i++)
+        {
+            sizes[i] = inner->cumulative[i] - (i > 0 ? inner->cumulative[i - 1] : 0);
+        }
+    }
+
+    // Walk to the leaf that would hold value, adding the sizes of everything left of the path.
+    const Leaf *descend(int value, int &count) const
+    {
+        const void *node = root;
+        for (int level = height; level > 0; level--)
+        {
+            const Inner *inner = (const Inner *)node;
+            int child = route(inner, value);
+            if (child > 0)
+            {
+                count += inner->cumulative[child - 1];
+            }
+            node = inner->children[child];
+        }
+        return (const Leaf *)node;
+    }
+
+    /**
+     * @brief Insert below a node, splitting it when it overflows.
+     */
+    void insertInto(void *node, int level, int value, Split &split)
+    {
+        if (level == 0)
+        {
+            Leaf *leaf = (Leaf *)node;
+            int position = countLess16(leaf->keys, value, leaf->count);
+            if (position < leaf->count && leaf->keys[position] == value)
+            {
+                leaf->copies[position]++;
+                leaf->total++;
+                return;
+            }
+
+            int keys[FANOUT + 1], copies[FANOUT + 1];
+            for (int i = 0, j = 0; i <= leaf->count; i++)
+            {
+                keys[i] = i == position ? value : leaf->keys[j];
+                copies[i] = i == position ? 1 : leaf->copies[j++];
+            }
+            int entries = leaf->count + 1;
+
+            if (entries <= FANOUT)
+            {
+                fillLeaf(leaf, keys, copies, entries);
+                return;
+            }
+
+            Leaf *right = new Leaf();
+            int leftCount = entries / 2;
+            fillLeaf(leaf, keys, copies, leftCount);
+            fillLeaf(right, keys + leftCount, copies + leftCount, entries - leftCount);
+            split.right = right;
+            split.separator = right->keys[0];
+            split.leftSize = leaf->total;
+            split.rightSize = right->total;
+            return;
+        }
+
+        Inner *inner = (Inner *)node;
+        int child = route(inner, value);
+        Split childSplit;
+        insertInto(inner->children[child], level - 1, value, childSplit);
+
+        if (childSplit.right == NULL)
+        {
+            for (int i = child; i < inner->count; i++)
+            {
+                inner->cumulative[i]++;
+            }
+            return;
+        }
+
+        // Splice the new sibling in after the child that split.
+        int oldSizes[FANOUT];
+        int sizes[FANOUT + 1];
+        int keys[FANOUT];
+        void *children[FANOUT + 1];
+        getSizes(inner, oldSizes);
+        int total = inner->count + 1;
+        for (int i = 0; i < total; i++)
+        {
+            if (i <= child)
+            {
+                children[i] = inner->children[i];
+                sizes[i] = i == child ? childSplit.leftSize : oldSizes[i];
+            }
+            else if (i == child + 1)
+            {
+                children[i] = childSplit.right;
+                sizes[i] = childSplit.rightSize;
+            }
+            else
+            {
+                children[i] = inner->children[i - 1];
+                sizes[i] = oldSizes[i - 1];
+            }
+        }
+        for (int i = 0; i < total - 1; i++)
+        {
+            if (i < child)
+            {
+                keys[i] = inner->keys[i];
+            }
+            else if (i == child)
+            {
+                keys[i] = childSplit.separator;
+            }
+            else
+            {
+                keys[i] = inner->keys[i - 1];
+            }
+        }
+
+        if (total <= FANOUT)
+        {
+            inner->count = total;
+            memcpy(inner->keys, keys, (total - 1) * sizeof(int));
+            memcpy(inner->children, children, total * sizeof(void *));
+            setCumulative(inner, sizes);
+            return;
+        }
+
+        // Overflow: the left half keeps leftCount children, the separator
+        // between the halves moves up to the parent.
+        Inner *right = new Inner();
+        int leftCount = total / 2;
+        inner->count = leftCount;
+        right->count = total - leftCount;
+        memcpy(inner->keys, keys, (leftCount - 1) * sizeof(int));
+        memcpy(inner->children, children, leftCount * sizeof(void *));
+        memcpy(right->keys, keys + leftCount, (right->count - 1) * sizeof(int));
+        memcpy(right->children, children + leftCount, right->count * sizeof(void *));
+        setCumulative(inner, sizes);
+        setCumulative(right, sizes + leftCount);
+
+        split.right = right;
+        split.separator = keys[leftCount - 1];
+        split.leftSize = subtreeTotal(inner, level);
+        split.rightSize = subtreeTotal(right, level);
+    }
+
+    /**
+     * @brief Remove a value below a node, fixing up any child that underflows.
+     *
+     * @return bool False when the value was not present.
+     */
+    bool eraseFrom(void *node, int level, int value)
+    {
+        if (level == 0)
+        {
+            Leaf *leaf = (Leaf *)node;
+            int position = countLess16(leaf->keys, value, leaf->count);
+            if (position == leaf->count || leaf->keys[position] != value)
+            {
+                return false;
+            }
+            leaf->total--;
+            if (--leaf->copies[position] > 0)
+            {
+                return true;
+            }
+            memmove(leaf->keys + position, leaf->keys + position + 1,
+                    (leaf->count - position - 1) * sizeof(int));
+            memmove(leaf->copies + position, leaf->copies + position + 1,
+                    (leaf->count - position - 1) * sizeof(int));
+            leaf->count--;
+            return true;
+        }
+
+        Inner *inner = (Inner *)node;
+        int child = route(inner, value);
+        if (!eraseFrom(inner->children[child], level - 1, value))
+        {
+            return false;
+        }
+        for (int i = child; i < inner->count; i++)
+        {
+            inner->cumulative[i]--;
+        }
+
+        if (entryCount(inner->children[child], level - 1) < MIN_FILL && inner->count > 1)
+        {
+            int left = child + 1 < inner->count ? child : child - 1;
+            rebalanceChildren(inner, left, level - 1);
+        }
+        return true;
+    }
+
+    static int entryCount(const void *node, int level)
+    {
+        return level == 0 ? ((const Leaf *)node)->count : ((const Inner *)node)->count;
+    }
+
+    /**
+     * @brief Merge children left and left + 1 of a node, or split their
+     * entries evenly when they do not fit in one node.
+     */
+    void rebalanceChildren(Inner *parent, int left, int childLevel)
+    {
+        int sizes[FANOUT];
+        getSizes(parent, sizes);
+        bool merged;
+
+        if (childLevel == 0)
+        {
+            Leaf *a = (Leaf *)parent->children[left];
+            Leaf *b = (Leaf *)parent->children[left + 1];
+            int keys[2 * FANOUT], copies[2 * FANOUT];
+            int entries = a->count + b->count;
+            memcpy(keys, a->keys, a->count * sizeof(int));
+            memcpy(keys + a->count, b->keys, b->count * sizeof(int));
+            memcpy(copies, a->copies, a->count * sizeof(int));
+            memcpy(copies + a->count, b->copies, b->count * sizeof(int));
+
+            merged = entries <= FANOUT;
+            if (merged)
+            {
+                fillLeaf(a, keys, copies, entries);
+                delete b;
+                sizes[left] = a->total;
+            }
+            else
+            {
+                int leftCount = entries / 2;
+                fillLeaf(a, keys, copies, leftCount);
+                fillLeaf(b, keys + leftCount, copies + leftCount, entries - leftCount);
+                parent->keys[left] = b->keys[0];
+                sizes[left] = a->total;
+                sizes[left + 1] = b->total;
+            }
+        }
+        else
+        {
+            Inner *a = (Inner *)parent->children[left];
+            Inner *b = (Inner *)parent->children[left + 1];
+            int keys[2 * FANOUT];
+            int childSizes[2 * FANOUT];
+            void *children[2 * FANOUT];
+            int total = a->count + b->count;
+
+            // The parent's separator comes down between the two key lists.
+            memcpy(keys, a->keys, (a->count - 1) * sizeof(int));
+            keys[a->count - 1] = parent->keys[left];
+            memcpy(keys + a->count, b->keys, (b->count - 1) * sizeof(int));
+            memcpy(children, a->children, a->count * sizeof(void *));
+            memcpy(children + a->count, b->children, b->count * sizeof(void *));
+            getSizes(a, childSizes);
+            getSizes(b, childSizes + a->count);
+
+            merged = total <= FANOUT;
+            if (merged)
+            {
+                a->count = total;
+                memcpy(a->keys, keys, (total - 1) * sizeof(int));
+                memcpy(a->children, children, total * sizeof(void *));
+                setCumulative(a, childSizes);
+                delete b;
+                sizes[left] = subtreeTotal(a, childLevel);
+            }
+            else
+            {
+                a->count = total / 2;
+                b->count = total - a->count;
+                memcpy(a->keys, keys, (a->count - 1) * sizeof(int));
+                memcpy(a->children, children, a->count * sizeof(void *));
+                parent->keys[left] = keys[a->count - 1];
+                memcpy(b->keys, keys + a->count, (b->count - 1) * sizeof(int));
+                memcpy(b->children, children + a->count, b->count * sizeof(void *));
+                setCumulative(a, childSizes);
+                setCumulative(b, childSizes + a->count);
+                sizes[left] = subtreeTotal(a, childLevel);
+                sizes[left + 1] = subtreeTotal(b, childLevel);
+            }
+        }
+
+        if (merged)
+        {
+            // Drop separator keys[left] and child left + 1 from the parent.
+            memmove(parent->keys + left, parent->keys + left + 1,
+                    (parent->count - left - 2) * sizeof(int));
+            memmove(parent->children + left + 1, parent->children + left + 2,
+                    (parent->count - left - 2) * sizeof(void *));
+            memmove(sizes + left + 1, sizes + left + 2, (parent->count - left - 2) * sizeof(int));
+            parent->count--;
+        }
+        setCumulative(parent, sizes);
+    }
+
+    static void destroy(void *node, int level)
+    {
+        if (level == 0)
+        {
+            delete (Leaf *)node;
+            return;
+        }
+        Inner *inner = (Inner *)node;
+        for (int i = 0; i < inner->count; i++)
+        {
+            destroy(inner->children[i], level - 1);
+        }
+        delete inner;
+    }
+
+    void *root;
+    int height;
+};
+
+#endif
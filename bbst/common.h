@@ -0,0 +1,47 @@
+/**
+ * @file common.h
+ * @brief The standard and POSIX headers every index in bbst/ builds on.
+ *
+ * Like BBSTSelect.cpp the indexes are written against namespace std
+ * unqualified, so this header brings it in. Free functions and globals in
+ * the other headers are inline, so any of them can be included from more
+ * than one translation unit of a program.
+ */
+
+#ifndef BBST_COMMON_H
+#define BBST_COMMON_H
+
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#endif
@@ -0,0 +1,604 @@
+/**
+ * @file concurrent.h
+ * @brief Concurrent B+-tree with optimistic version locks.
+ */
+
+#ifndef BBST_CONCURRENT_H
+#define BBST_CONCURRENT_H
+
+#include "common.h"
+
+/**
+ * @brief Version lock used for optimistic lock coupling.
+ *
+ * Even versions are unlocked. Readers remember the version, read without
+ * locking and validate afterwards; any writer in between has moved the
+ * version on, which sends the reader back to the root. Writers make the
+ * version odd while they hold the lock and bump it again on release.
+ */
+class VersionLock
+{
+public:
+    VersionLock() : version(0) {}
+
+    /**
+     * @brief Wait until the lock is free and return the version to validate against.
+     */
+    uint64_t readBegin() const
+    {
+        int spins = 0;
+        uint64_t v;
+        while ((v = version.load(memory_order_acquire)) & 1)
+        {
+            backoff(spins);
+        }
+        return v;
+    }
+
+    /**
+     * @brief Whether nothing was written since readBegin() returned v.
+     */
+    bool validate(uint64_t v) const
+    {
+        atomic_thread_fence(memory_order_acquire);
+        return version.load(memory_order_relaxed) == v;
+    }
+
+    /**
+     * @brief Take the lock if the version is still v (a validated optimistic read).
+     */
+    bool tryUpgrade(uint64_t v)
+    {
+        return version.compare_exchange_strong(v, v + 1, memory_order_acquire);
+    }
+
+    void lock()
+    {
+        int spins = 0;
+        while (true)
+        {
+            uint64_t v = version.load(memory_order_relaxed);
+            if (!(v & 1) && version.compare_exchange_weak(v, v + 1, memory_order_acquire))
+            {
+                return;
+            }
+            backoff(spins);
+        }
+    }
+
+    void unlock() { version.fetch_add(1, memory_order_release); }
+
+    // Spin briefly, then give the core away; the holder may be descheduled.
+    static void backoff(int &spins)
+    {
+        if (++spins < 64)
+        {
+#ifdef __SSE2__
+            _mm_pause();
+#endif
+        }
+        else
+        {
+            this_thread::yield();
+        }
+    }
+
+private:
+    atomic<uint64_t> version;
+};
+
+/**
+ * @brief Concurrent order-statistic index: a counted B+-tree (see BPlusTree)
+ * synchronized with optimistic lock coupling.
+ *
+ * Reads never write shared memory. They descend while holding only the
+ * version of the current node and validate each parent after reading the
+ * child's version, so a reader can neither overtake nor be overtaken by a
+ * writer on its path and always sees the subtree counts of one consistent
+ * state. Any conflicting write makes the reader restart from the root.
+ *
+ * A writer first descends optimistically and locks only the target leaf,
+ * where it decides whether the update changes the multiset (erasing a missing
+ * value returns right there). Only then does it lock-couple down from the
+ * root, adjusting the per-child counts on the way and splitting full nodes
+ * ahead of time, so it never has to come back up. Writers on different keys
+ * only contend where their paths share nodes, and only for the short time it
+ * takes to update one node.
+ *
+ * Erase leaves nodes in place (possibly empty) instead of merging them, so
+ * no node is ever freed while readers might still be looking at it.
+ */
+class ConcurrentTree
+{
+public:
+    static constexpr int FANOUT = 16;
+
+    ConcurrentTree() { root.store(new Leaf(), memory_order_relaxed); }
+    ~ConcurrentTree() { destroy(root.load(memory_order_relaxed)); }
+    ConcurrentTree(const ConcurrentTree &) = delete;
+    ConcurrentTree &operator=(const ConcurrentTree &) = delete;
+
+    void insert(int value) { update(value, 1); }
+    void erase(int value) { update(value, -1); }
+
+    int size() const
+    {
+        while (true)
+        {
+            uint64_t holderVersion = rootLock.readBegin();
+            NodeBase *node = root.load(memory_order_acquire);
+            uint64_t version = node->lock.readBegin();
+            int total = subtreeTotal(node);
+            if (rootLock.validate(holderVersion) && node->lock.validate(version))
+            {
+                return total;
+            }
+        }
+    }
+
+    bool select(int position, int &value) const
+    {
+        while (true)
+        {
+            int result;
+            int status = trySelect(position, result);
+            if (status >= 0)
+            {
+                value = result;
+                return status == 1;
+            }
+        }
+    }
+
+    int getRank(int value) const { return countBelow(value, true); }
+    int countLess(int value) const { return countBelow(value, false); }
+
+    int countRange(int low, int high) const
+    {
+        if (low > high)
+        {
+            return 0;
+        }
+        return getRank(high) - countLess(low);
+    }
+
+private:
+    struct NodeBase
+    {
+        NodeBase(bool isLeaf) : isLeaf(isLeaf), count(0) {}
+        VersionLock lock;
+        const bool isLeaf;
+        atomic<int> count; // Keys in a leaf, children in an inner node.
+        atomic<int> keys[FANOUT];
+    };
+
+    struct Leaf : NodeBase
+    {
+        Leaf() : NodeBase(true), total(0) {}
+        atomic<int> copies[FANOUT]; // Multiplicity of each distinct key.
+        atomic<int> total;          // Sum of the multiplicities.
+    };
+
+    struct Inner : NodeBase
+    {
+        Inner() : NodeBase(false) {}
+        atomic<int> cumulative[FANOUT];
+        atomic<NodeBase *> children[FANOUT];
+    };
+
+    static int load(const atomic<int> &field) { return field.load(memory_order_relaxed); }
+    static void store(atomic<int> &field, int value) { field.store(value, memory_order_relaxed); }
+
+    static int subtreeTotal(const NodeBase *node)
+    {
+        if (node->isLeaf)
+        {
+            return load(((const Leaf *)node)->total);
+        }
+        int count = min(load(node->count), FANOUT);
+        return count == 0 ? 0 : load(((const Inner *)node)->cumulative[count - 1]);
+    }
+
+    // Index of the child whose key range holds value. May read torn state; callers validate.
+    static int route(const Inner *inner, int value)
+    {
+        int separators = min(max(load(inner->count) - 1, 0), FANOUT - 1);
+        int child = 0;
+        while (child < separators && load(inner->keys[child]) <= value)
+        {
+            child++;
+        }
+        return child;
+    }
+
+    /**
+     * @brief One optimistic select attempt.
+     *
+     * @return int 1 found, 0 out of range, -1 a writer interfered (retry).
+     */
+    int trySelect(int position, int &value) const
+    {
+        uint64_t parentVersion = rootLock.readBegin();
+        const NodeBase *node = root.load(memory_order_acquire);
+        uint64_t version = node->lock.readBegin();
+        if (!rootLock.validate(parentVersion))
+        {
+            return -1;
+        }
+
+        int total = subtreeTotal(node);
+        if (position < 1 || position > total)
+        {
+            return node->lock.validate(version) ? 0 : -1;
+        }
+
+        while (!node->isLeaf)
+        {
+            const Inner *inner = (const Inner *)node;
+            int count = min(load(inner->count), FANOUT);
+            int child = 0;
+            while (child < count - 1 && load(inner->cumulative[child]) < position)
+            {
+                child++;
+            }
+            int skipped = child > 0 ? load(inner->cumulative[child - 1]) : 0;
+            const NodeBase *next = inner->children[child].load(memory_order_acquire);
+            if (next == NULL || !node->lock.validate(version))
+            {
+                return -1;
+            }
+            uint64_t nextVersion = next->lock.readBegin();
+            if (!node->lock.validate(version))
+            {
+                return -1;
+            }
+            position -= skipped;
+            node = next;
+            version = nextVersion;
+        }
+
+        const Leaf *leaf = (const Leaf *)node;
+        int count = min(load(leaf->count), FANOUT);
+        int entry = 0;
+        while (entry < count && position > load(leaf->copies[entry]))
+        {
+            position -= load(leaf->copies[entry]);
+            entry++;
+        }
+        if (entry == count)
+        {
+            return -1;
+        }
+        value = load(leaf->keys[entry]);
+        return node->lock.validate(version) ? 1 : -1;
+    }
+
+    /**
+     * @brief Number of values <= value (inclusive) or < value (otherwise).
+     */
+    int countBelow(int value, bool inclusive) const
+    {
+        while (true)
+        {
+            int result = tryCountBelow(value, inclusive);
+            if (result >= 0)
+            {
+                return result;
+            }
+        }
+    }
+
+    /**
+     * @brief One optimistic countBelow() attempt; -1 when a writer interfered.
+     */
+    int tryCountBelow(int value, bool inclusive) const
+    {
+        uint64_t parentVersion = rootLock.readBegin();
+        const NodeBase *node = root.load(memory_order_acquire);
+        uint64_t version = node->lock.readBegin();
+        if (!rootLock.validate(parentVersion))
+        {
+            return -1;
+        }
+
+        int result = 0;
+        while (!node->isLeaf)
+        {
+            const Inner *inner = (const Inner *)node;
+            int child = route(inner, value);
+            int skipped = child > 0 ? load(inner->cumulative[child - 1]) : 0;
+            const NodeBase *next = inner->children[child].load(memory_order_acquire);
+            if (next == NULL || !node->lock.validate(version))
+            {
+                return -1;
+            }
+            uint64_t nextVersion = next->lock.readBegin();
+            if (!node->lock.validate(version))
+            {
+                return -1;
+            }
+            result += skipped;
+            node = next;
+            version = nextVersion;
+        }
+
+        const Leaf *leaf = (const Leaf *)node;
+        int count = min(load(leaf->count), FANOUT);
+        for (int i = 0; i < count; i++)
+        {
+            int key = load(leaf->keys[i]);
+            if (key > value || (!inclusive && key == value))
+            {
+                break;
+            }
+            result += load(leaf->copies[i]);
+        }
+        return node->lock.validate(version) ? result : -1;
+    }
+
+    /**
+     * @brief Optimistically find and lock the leaf whose range holds value.
+     */
+    Leaf *lockLeaf(int value)
+    {
+        while (true)
+        {
+            uint64_t parentVersion = rootLock.readBegin();
+            NodeBase *node = root.load(memory_order_acquire);
+            uint64_t version = node->lock.readBegin();
+            if (!rootLock.validate(parentVersion))
+            {
+                continue;
+            }
+
+            bool restart = false;
+            while (!node->isLeaf)
+            {
+                Inner *inner = (Inner *)node;
+                NodeBase *next = inner->children[route(inner, value)].load(memory_order_acquire);
+                if (next == NULL || !node->lock.validate(version))
+                {
+                    restart = true;
+                    break;
+                }
+                uint64_t nextVersion = next->lock.readBegin();
+                if (!node->lock.validate(version))
+                {
+                    restart = true;
+                    break;
+                }
+                node = next;
+                version = nextVersion;
+            }
+
+            if (!restart && node->lock.tryUpgrade(version))
+            {
+                return (Leaf *)node;
+            }
+        }
+    }
+
+    static int leafPosition(const Leaf *leaf, int value)
+    {
+        int count = load(leaf->count);
+        int position = 0;
+        while (position < count && load(leaf->keys[position]) < value)
+        {
+            position++;
+        }
+        return position;
+    }
+
+    /**
+     * @brief Insert (delta = 1) or erase (delta = -1) one value.
+     */
+    void update(int value, int delta)
+    {
+        Leaf *target = lockLeaf(value);
+        int position = leafPosition(target, value);
+        bool present = position < load(target->count) && load(target->keys[position]) == value;
+        if (delta < 0 && !present)
+        {
+            // Missing erase: nothing changes.
+            target->lock.unlock();
+            return;
+        }
+
+        // Lock-couple down from the root, counting the change in every
+        // ancestor and splitting full nodes before entering them.
+        rootLock.lock();
+        Inner *parent = NULL;
+        NodeBase *node = root.load(memory_order_relaxed);
+        if (node != target)
+        {
+            node->lock.lock();
+        }
+
+        while (true)
+        {
+            if (delta > 0 && load(node->count) == FANOUT)
+            {
+                node = splitChild(parent, node, value);
+            }
+
+            if (parent != NULL)
+            {
+                int child = route(parent, value);
+                for (int i = child; i < load(parent->count); i++)
+                {
+                    store(parent->cumulative[i], load(parent->cumulative[i]) + delta);
+                }
+                parent->lock.unlock();
+            }
+            else
+            {
+                rootLock.unlock();
+            }
+
+            if (node->isLeaf)
+            {
+                break;
+            }
+            parent = (Inner *)node;
+            node = parent->children[route(parent, value)].load(memory_order_relaxed);
+            if (node != target)
+            {
+                node->lock.lock();
+            }
+        }
+
+        // node is the (possibly freshly split) locked leaf that holds value.
+        Leaf *leaf = (Leaf *)node;
+        int count = load(leaf->count);
+        position = leafPosition(leaf, value);
+        store(leaf->total, load(leaf->total) + delta);
+        if (present)
+        {
+            int copies = load(leaf->copies[position]) + delta;
+            store(leaf->copies[position], copies);
+            if (copies == 0)
+            {
+                for (int i = position; i < count - 1; i++)
+                {
+                    store(leaf->keys[i], load(leaf->keys[i + 1]));
+                    store(leaf->copies[i], load(leaf->copies[i + 1]));
+                }
+                store(leaf->count, count - 1);
+            }
+        }
+        else
+        {
+            for (int i = count; i > position; i--)
+            {
+                store(leaf->keys[i], load(leaf->keys[i - 1]));
+                store(leaf->copies[i], load(leaf->copies[i - 1]));
+            }
+            store(leaf->keys[position], value);
+            store(leaf->copies[position], 1);
+            store(leaf->count, count + 1);
+        }
+        leaf->lock.unlock();
+    }
+
+    /**
+     * @brief Split a full, locked node under its locked parent (or the root
+     * holder when parent is NULL, in which case parent becomes the new,
+     * locked root). The half that does not hold value is unlocked; the half
+     * that does is returned still locked.
+     */
+    NodeBase *splitChild(Inner *&parent, NodeBase *node, int value)
+    {
+        int count = load(node->count);
+        int leftCount = count / 2;
+        NodeBase *right;
+        int separator;
+
+        if (node->isLeaf)
+        {
+            Leaf *leaf = (Leaf *)node;
+            Leaf *sibling = new Leaf();
+            int moved = 0;
+            for (int i = leftCount; i < count; i++)
+            {
+                store(sibling->keys[i - leftCount], load(leaf->keys[i]));
+                store(sibling->copies[i - leftCount], load(leaf->copies[i]));
+                moved += load(leaf->copies[i]);
+            }
+            store(sibling->count, count - leftCount);
+            store(sibling->total, moved);
+            store(leaf->total, load(leaf->total) - moved);
+            separator = load(sibling->keys[0]);
+            right = sibling;
+        }
+        else
+        {
+            Inner *inner = (Inner *)node;
+            Inner *sibling = new Inner();
+            int base = load(inner->cumulative[leftCount - 1]);
+            for (int i = leftCount; i < count; i++)
+            {
+                sibling->children[i - leftCount].store(inner->children[i].load(memory_order_relaxed),
+                                                       memory_order_relaxed);
+                store(sibling->cumulative[i - leftCount], load(inner->cumulative[i]) - base);
+                if (i + 1 < count)
+                {
+                    store(sibling->keys[i - leftCount], load(inner->keys[i]));
+                }
+            }
+            store(sibling->count, count - leftCount);
+            separator = load(inner->keys[leftCount - 1]);
+            right = sibling;
+        }
+        // The sibling is unreachable until the parent links it, so it can be
+        // locked without contention before it is published.
+        right->lock.lock();
+        store(node->count, leftCount);
+
+        int leftSize = subtreeTotal(node);
+        int rightSize = subtreeTotal(right);
+        if (parent == NULL)
+        {
+            Inner *newRoot = new Inner();
+            newRoot->children[0].store(node, memory_order_relaxed);
+            newRoot->children[1].store(right, memory_order_relaxed);
+            store(newRoot->keys[0], separator);
+            store(newRoot->cumulative[0], leftSize);
+            store(newRoot->cumulative[1], leftSize + rightSize);
+            store(newRoot->count, 2);
+            // The new root becomes the locked parent for the rest of the descent.
+            newRoot->lock.lock();
+            root.store(newRoot, memory_order_release);
+            rootLock.unlock();
+            parent = newRoot;
+        }
+        else
+        {
+            int parentCount = load(parent->count);
+            int child = route(parent, value);
+            for (int i = parentCount; i > child + 1; i--)
+            {
+                parent->children[i].store(parent->children[i - 1].load(memory_order_relaxed),
+                                          memory_order_relaxed);
+                store(parent->cumulative[i], load(parent->cumulative[i - 1]));
+            }
+            for (int i = parentCount - 1; i > child; i--)
+            {
+                store(parent->keys[i], load(parent->keys[i - 1]));
+            }
+            int before = child > 0 ? load(parent->cumulative[child - 1]) : 0;
+            parent->children[child + 1].store(right, memory_order_release);
+            store(parent->keys[child], separator);
+            store(parent->cumulative[child], before + leftSize);
+            store(parent->cumulative[child + 1], before + leftSize + rightSize);
+            store(parent->count, parentCount + 1);
+        }
+
+        if (value < separator)
+        {
+            right->lock.unlock();
+            return node;
+        }
+        node->lock.unlock();
+        return right;
+    }
+
+    static void destroy(NodeBase *node)
+    {
+        if (!node->isLeaf)
+        {
+            Inner *inner = (Inner *)node;
+            for (int i = 0; i < load(inner->count); i++)
+            {
+                destroy(inner->children[i].load(memory_order_relaxed));
+            }
+            delete inner;
+            return;
+        }
+        delete (Leaf *)node;
+    }
+
+    VersionLock rootLock;
+    atomic<NodeBase *> root;
+};
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * @file fenwick.h
+ * @brief Fenwick-tree index over a bounded key domain.
+ */
+
+#ifndef BBST_FENWICK_H
+#define BBST_FENWICK_H
+
+#include "common.h"
+#include "avl.h"
+
+/**
+ * @brief The largest domain indexed with a FenwickIndex, which allocates
+ * one int per key of the domain up front: 256 MB at this limit.
+ */
+const int FENWICK_MAX_DOMAIN = 1 << 26;
+
+/**
+ * @brief Order-statistic index for keys from a bounded domain [low, high]:
+ * a Fenwick (binary indexed) tree over the number of copies of every key.
+ *
+ * Insert, erase, rank and select are each one O(log U) pass over a flat
+ * array, U = high - low + 1, with no allocation per key; select uses binary
+ * lifting, descending from the largest power of two in one pass instead of
+ * binary searching over prefix sums. Keys outside the domain are still
+ * accepted: they spill into an AVL tree, which lies wholly below or above
+ * the domain, so every query combines the two by counts. The flat array is
+ * the only per-key storage, 4 bytes per key of the domain; a single key's
+ * count is the difference of two prefix sums.
+ */
+class FenwickIndex
+{
+public:
+    FenwickIndex(int low, int high)
+        : low(low), domain((size_t)((long long)high - low + 1)), tree(domain + 1, 0), total(0)
+    {
+        topStep = 1;
+        while (topStep * 2 <= domain)
+        {
+            topStep *= 2;
+        }
+    }
+
+    void insert(int value)
+    {
+        if (!inDomain(value))
+        {
+            spill.insert(value);
+            return;
+        }
+        add(value - (long long)low, 1);
+    }
+
+    void erase(int value)
+    {
+        if (!inDomain(value))
+        {
+            spill.erase(value);
+            return;
+        }
+        size_t index = value - (long long)low;
+        if (prefix(index + 1) > prefix(index))
+        {
+            add(index, -1);
+        }
+    }
+
+    /**
+     * @brief Insert many values into an empty index at once: the counts go
+     * into the Fenwick array's own slots, which one O(U) sweep then turns
+     * into partial sums, instead of a pass per value.
+     */
+    void insertAll(const vector<int> &values)
+    {
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            if (inDomain(values[i]))
+            {
+                tree[values[i] - (long long)low + 1]++;
+                total++;
+            }
+            else
+            {
+                spill.insert(values[i]);
+            }
+        }
+        for (size_t i = 1; i <= domain; i++)
+        {
+            size_t parent = i + (i & (0 - i));
+            if (parent <= domain)
+            {
+                tree[parent] += tree[i];
+            }
+        }
+    }
+
+    bool select(int position, int &value) const
+    {
+        int below = spill.countLess(low);
+        if (position <= below)
+        {
+            return spill.select(position, value);
+        }
+        if (position > below + total)
+        {
+            return spill.select(position - total, value);
+        }
+
+        // Binary lifting: the largest prefix holding fewer than `remaining` values.
+        int remaining = position - below;
+        size_t index = 0;
+        for (size_t step = topStep; step > 0; step >>= 1)
+        {
+            if (index + step <= domain && tree[index + step] < remaining)
+            {
+                index += step;
+                remaining -= tree[index];
+            }
+        }
+        value = (int)(low + (long long)index);
+        return true;
+    }
+
+    int getRank(int value) const
+    {
+        if (value < low)
+        {
+            return spill.getRank(value);
+        }
+        if (!inDomain(value))
+        {
+            return spill.getRank(value) + total;
+        }
+        return spill.countLess(low) + prefix(value - (long long)low + 1);
+    }
+
+    int countLess(int value) const
+    {
+        if (value <= low)
+        {
+            return spill.countLess(value);
+        }
+        return getRank(value - 1);
+    }
+
+    int countRange(int lowValue, int highValue) const
+    {
+        return lowValue > highValue ? 0 : getRank(highValue) - countLess(lowValue);
+    }
+
+    int size() const { return total + spill.size(); }
+
+private:
+    bool inDomain(int value) const { return value >= low && (size_t)(value - (long long)low) < domain; }
+
+    void add(size_t index, int delta)
+    {
+        total += delta;
+        for (size_t i = index + 1; i <= domain; i += i & (0 - i))
+        {
+            tree[i] += delta;
+        }
+    }
+
+    // The number of values among the first `length` keys of the domain.
+    int prefix(size_t length) const
+    {
+        int sum = 0;
+        for (size_t i = length; i > 0; i -= i & (0 - i))
+        {
+            sum += tree[i];
+        }
+        return sum;
+    }
+
+    int low;
+    size_t domain, topStep;
+    vector<int> tree;
+    int total;
+    AVLTree spill;
+};
+
+#endif
@@ -0,0 +1,134 @@
+/**
+ * @file frozen.h
+ * @brief Read-only Eytzinger-layout index frozen from an AVL tree.
+ */
+
+#ifndef BBST_FROZEN_H
+#define BBST_FROZEN_H
+
+#include "common.h"
+#include "avl.h"
+
+/**
+ * @brief A read-only copy of a tree in Eytzinger (BFS) order.
+ *
+ * freeze() lays the distinct values out as an implicit complete binary tree:
+ * node i has its children at 2i and 2i + 1, so there are no pointers and the
+ * top levels share a few cache lines. Next to each value it keeps the number
+ * of stored values up to and including it (the embedded counts), in its own
+ * array, so select searches one array of counts and rank one array of keys.
+ * Each descent step is a comparison folded into the next index rather than a
+ * branch, and the node four levels further down (whose 16 candidates share
+ * one cache line) is prefetched while the current level is compared.
+ */
+class FrozenIndex
+{
+public:
+    FrozenIndex() : values(0) {}
+
+    /**
+     * @brief Build the index from the current contents of a tree.
+     *
+     * @param root The root of the tree to copy.
+     */
+    void freeze(Node *root)
+    {
+        vector<int> sortedKeys, sortedCounts;
+        collect(root, sortedKeys, sortedCounts);
+        size_t n = sortedKeys.size();
+
+        keys.assign(n + 1, 0);
+        through.assign(n + 1, 0);
+        counts.assign(n + 1, 0);
+        size_t next = 0;
+        int total = 0;
+        place(1, sortedKeys, sortedCounts, next, total);
+        values = total;
+    }
+
+    bool select(int position, int &value) const
+    {
+        if (position < 1 || position > values)
+        {
+            return false;
+        }
+        // The first node, in order, with at least `position` values up to it.
+        value = keys[descend(through, position - 1)];
+        return true;
+    }
+
+    int getRank(int value) const
+    {
+        size_t i = descend(keys, value);
+        return i == 0 ? values : through[i] - counts[i];
+    }
+
+    int countLess(int value) const
+    {
+        if (value == numeric_limits<int>::min())
+        {
+            return 0;
+        }
+        size_t i = descend(keys, value - 1);
+        return i == 0 ? values : through[i] - counts[i];
+    }
+
+    int countRange(int low, int high) const { return low > high ? 0 : getRank(high) - countLess(low); }
+    int size() const { return values; }
+
+private:
+    // In-order copy of the distinct values and their counts.
+    static void collect(Node *node, vector<int> &sortedKeys, vector<int> &sortedCounts)
+    {
+        if (node == NULL)
+        {
+            return;
+        }
+        collect(node->left, sortedKeys, sortedCounts);
+        sortedKeys.push_back(node->value);
+        sortedCounts.push_back(node->count);
+        collect(node->right, sortedKeys, sortedCounts);
+    }
+
+    // Fills slot i and its descendants in order from the sorted arrays.
+    void place(size_t i, const vector<int> &sortedKeys, const vector<int> &sortedCounts, size_t &next, int &total)
+    {
+        if (i >= keys.size())
+        {
+            return;
+        }
+        place(2 * i, sortedKeys, sortedCounts, next, total);
+        keys[i] = sortedKeys[next];
+        counts[i] = sortedCounts[next];
+        total += counts[i];
+        through[i] = total;
+        next++;
+        place(2 * i + 1, sortedKeys, sortedCounts, next, total);
+    }
+
+    /**
+     * @brief The first slot, in order, whose entry in `array` exceeds bound,
+     * or 0 when there is none.
+     */
+    size_t descend(const vector<int> &array, int bound) const
+    {
+        size_t n = array.size() - 1;
+        size_t i = 1;
+        while (i <= n)
+        {
+            prefetchNode(array.data() + min(16 * i, n));
+            i = 2 * i + (array[i] <= bound);
+        }
+        // Undo the trailing right turns, and the left turn before them.
+        while (i & 1)
+        {
+            i >>= 1;
+        }
+        return i >> 1;
+    }
+
+    vector<int> keys, through, counts;
+    int values;
+};
+
+#endif
@@ -0,0 +1,424 @@
+/**
+ * @file io.h
+ * @brief Buffered input scanning, output buffering and classic-mode readers.
+ */
+
+#ifndef BBST_IO_H
+#define BBST_IO_H
+
+#include "common.h"
+
+/**
+ * @brief Block buffered reader for the stream mode.
+ *
+ * Pulls the input in large fread() blocks and parses integers in place,
+ * so the per-command cost is a handful of character comparisons instead of
+ * a getline() + stringstream + stoi() round trip with temporary strings.
+ */
+class InputScanner
+{
+public:
+    InputScanner(FILE *file) : file(file), pos(0), len(0), overflowed(false) {}
+
+    /**
+     * @brief Skip whitespace and return the next character without consuming it.
+     *
+     * @return int The next character, or EOF.
+     */
+    int peek()
+    {
+        while (true)
+        {
+            if (pos == len && !refill())
+            {
+                return EOF;
+            }
+            unsigned char c = buffer[pos];
+            if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+            {
+                return c;
+            }
+            pos++;
+        }
+    }
+
+    /**
+     * @brief Consume the next non-whitespace character.
+     *
+     * @return int The character, or EOF.
+     */
+    int next()
+    {
+        int c = peek();
+        if (c != EOF)
+        {
+            pos++;
+        }
+        return c;
+    }
+
+    /**
+     * @brief Parse the next integer on the current line.
+     *
+     * @param value Receives the parsed integer.
+     * @return bool False when the line has no further integer token, or when
+     * it is outside the int range (then the token is consumed and
+     * outOfRange() is set).
+     */
+    bool readInt(int &value)
+    {
+        overflowed = false;
+        int c = peekInLine();
+        bool negative = false;
+        if (c == '-' || c == '+')
+        {
+            negative = c == '-';
+            pos++;
+            if (pos == len && !refill())
+            {
+                return false;
+            }
+        }
+        if (pos == len || buffer[pos] < '0' || buffer[pos] > '9')
+        {
+            return false;
+        }
+
+        long long result = 0;
+        long long limit = negative ? -(long long)INT_MIN : INT_MAX;
+        while (true)
+        {
+            if (pos == len && !refill())
+            {
+                break;
+            }
+            unsigned char digit = buffer[pos] - '0';
+            if (digit > 9)
+            {
+                break;
+            }
+            // Stop accumulating once out of range, but consume the whole token.
+            if (result <= limit)
+            {
+                result = result * 10 + digit;
+            }
+            pos++;
+        }
+        if (result > limit)
+        {
+            overflowed = true;
+            return false;
+        }
+        value = (int)(negative ? -result : result);
+        return true;
+    }
+
+    /**
+     * @brief Whether the last readInt() failed on an integer outside the int range.
+     */
+    bool outOfRange() const { return overflowed; }
+
+    /**
+     * @brief Discard the remainder of the current line.
+     */
+    void skipLine()
+    {
+        while (true)
+        {
+            if (pos == len && !refill())
+            {
+                return;
+            }
+            if (buffer[pos++] == '\n')
+            {
+                return;
+            }
+        }
+    }
+
+private:
+    // Like peek(), but never moves past the end of the current line.
+    int peekInLine()
+    {
+        while (true)
+        {
+            if (pos == len && !refill())
+            {
+                return EOF;
+            }
+            unsigned char c = buffer[pos];
+            if (c != ' ' && c != '\t' && c != '\r')
+            {
+                return c;
+            }
+            pos++;
+        }
+    }
+
+    bool refill()
+    {
+        len = fread(buffer, 1, sizeof(buffer), file);
+        pos = 0;
+        return len > 0;
+    }
+
+    FILE *file;
+    size_t pos, len;
+    bool overflowed;
+    char buffer[1 << 16];
+};
+
+/**
+ * @brief Reports a token readInt() rejected, on stderr, and moves past it:
+ * an out-of-range integer was already consumed, anything else loses one
+ * character.
+ *
+ * @param scanner The scanner whose readInt() failed.
+ * @param kind What the token should have been, e.g. "sample".
+ */
+inline void reportMalformed(InputScanner &scanner, const char *kind)
+{
+    if (scanner.outOfRange())
+    {
+        fprintf(stderr, "Skipping out-of-range %s\n", kind);
+    }
+    else
+    {
+        fprintf(stderr, "Skipping malformed %s '%c'\n", kind, scanner.next());
+    }
+}
+
+/**
+ * @brief Block buffered writer for the stream mode. Answers are formatted
+ * straight into a fixed buffer which is written out with a single fwrite()
+ * whenever it fills up, and once more on destruction.
+ */
+class OutputBuffer
+{
+public:
+    OutputBuffer(FILE *file) : file(file), len(0) {}
+    ~OutputBuffer() { flush(); }
+
+    void writeInt(long long value)
+    {
+        reserve(24);
+        unsigned long long magnitude = value;
+        if (value < 0)
+        {
+            buffer[len++] = '-';
+            magnitude = 0ULL - magnitude;
+        }
+        char digits[20];
+        int count = 0;
+        do
+        {
+            digits[count++] = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while (magnitude != 0);
+        while (count > 0)
+        {
+            buffer[len++] = digits[--count];
+        }
+    }
+
+    void writeString(const char *text)
+    {
+        size_t textLength = strlen(text);
+        reserve(textLength);
+        memcpy(buffer + len, text, textLength);
+        len += textLength;
+    }
+
+    void writeChar(char c)
+    {
+        reserve(1);
+        buffer[len++] = c;
+    }
+
+    void flush()
+    {
+        fwrite(buffer, 1, len, file);
+        fflush(file);
+        len = 0;
+    }
+
+private:
+    void reserve(size_t amount)
+    {
+        if (len + amount > sizeof(buffer))
+        {
+            flush();
+        }
+    }
+
+    FILE *file;
+    size_t len;
+    char buffer[1 << 16];
+};
+
+/**
+ * @brief Classic mode input reader. The whole input is read in large
+ * fread() blocks and every token is converted in place with from_chars(),
+ * so there is no per-value allocation, repeated or trailing spaces are
+ * harmless, and values may be spread over any number of lines: the last
+ * non-empty line holds the positions and every line before it holds values.
+ * A single non-empty line is all values. Malformed or out of range tokens
+ * are reported on stderr and skipped. A token cut by the end of a block is
+ * carried into the next one whatever its length, growing the buffer if needed.
+ *
+ * @param input The input, read to EOF.
+ * @param values Receives the values.
+ * @param positions Receives the positions.
+ * @return int The number of malformed tokens, plus one for a read error.
+ */
+inline int readClassicText(FILE *input, vector<int> &values, vector<int> &positions)
+{
+    const size_t BLOCK = 1 << 16;
+    vector<char> buffer(BLOCK);
+    size_t carried = 0;
+    int errors = 0;
+    int lines = 0;
+    bool lineStarted = false;
+
+    while (true)
+    {
+        size_t length = carried + fread(buffer.data() + carried, 1, BLOCK, input);
+        bool last = length == carried;
+        const char *cursor = buffer.data();
+        const char *end = buffer.data() + length;
+        carried = 0;
+
+        while (cursor < end)
+        {
+            char c = *cursor;
+            if (c == '\n')
+            {
+                lineStarted = false;
+                cursor++;
+                continue;
+            }
+            if (c == ' ' || c == '\t' || c == '\r')
+            {
+                cursor++;
+                continue;
+            }
+
+            // A token cut by the end of the block is finished with the next block.
+            const char *tokenEnd = cursor;
+            while (tokenEnd < end && *tokenEnd != ' ' && *tokenEnd != '\t' && *tokenEnd != '\r' &&
+                   *tokenEnd != '\n')
+            {
+                tokenEnd++;
+            }
+            if (tokenEnd == end && !last)
+            {
+                carried = end - cursor;
+                memmove(buffer.data(), cursor, carried);
+                if (buffer.size() < carried + BLOCK)
+                {
+                    buffer.resize(carried + BLOCK);
+                }
+                break;
+            }
+
+            if (!lineStarted)
+            {
+                // A new non-empty line: the previous one held values after all.
+                values.insert(values.end(), positions.begin(), positions.end());
+                positions.clear();
+                lineStarted = true;
+                lines++;
+            }
+
+            const char *digits = *cursor == '+' ? cursor + 1 : cursor;
+            int value;
+            from_chars_result parsed = from_chars(digits, tokenEnd, value);
+            if (parsed.ec == errc() && parsed.ptr == tokenEnd)
+            {
+                positions.push_back(value);
+            }
+            else
+            {
+                fprintf(stderr, "Skipping malformed value '%.*s'\n", (int)min<ptrdiff_t>(tokenEnd - cursor, 32),
+                        cursor);
+                errors++;
+            }
+            cursor = tokenEnd;
+        }
+
+        if (last)
+        {
+            break;
+        }
+    }
+
+    if (ferror(input))
+    {
+        fprintf(stderr, "Error reading input\n");
+        errors++;
+    }
+    if (lines == 1)
+    {
+        values.swap(positions);
+    }
+    return errors;
+}
+
+/**
+ * @brief Reads raw native-endian integers of the given width (4 or 8 bytes)
+ * as values, in blocks. 64-bit values outside the int range are reported on
+ * stderr and skipped.
+ *
+ * @param input The binary input, read to EOF.
+ * @param width The integer width in bytes.
+ * @param values Receives the values.
+ * @return int The number of skipped values, plus one for a truncated last
+ * value and one for a read error.
+ */
+inline int readClassicBinary(FILE *input, int width, vector<int> &values)
+{
+    const size_t BLOCK = 1 << 16;
+    vector<char> buffer(BLOCK * width);
+    int errors = 0;
+    size_t read;
+
+    while ((read = fread(buffer.data(), 1, buffer.size(), input)) > 0)
+    {
+        size_t count = read / width;
+        if (width == 4)
+        {
+            size_t offset = values.size();
+            values.resize(offset + count);
+            memcpy(values.data() + offset, buffer.data(), count * 4);
+        }
+        else
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                int64_t value;
+                memcpy(&value, buffer.data() + i * 8, 8);
+                if (value < numeric_limits<int>::min() || value > numeric_limits<int>::max())
+                {
+                    fprintf(stderr, "Skipping out of range value %lld\n", (long long)value);
+                    errors++;
+                    continue;
+                }
+                values.push_back((int)value);
+            }
+        }
+        if (read % width != 0)
+        {
+            // fread() only returns a partial item at the end of the file.
+            fprintf(stderr, "Ignoring %d trailing bytes\n", (int)(read % width));
+            errors++;
+        }
+    }
+    if (ferror(input))
+    {
+        fprintf(stderr, "Error reading input\n");
+        errors++;
+    }
+    return errors;
+}
+
+#endif
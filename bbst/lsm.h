@@ -0,0 +1,381 @@
+/**
+ * @file lsm.h
+ * @brief Log-structured order-statistic store.
+ */
+
+#ifndef BBST_LSM_H
+#define BBST_LSM_H
+
+#include "common.h"
+
+/**
+ * @brief Values and tombstones an LSMStore buffers before flushing them as a run.
+ */
+const int LSM_BUFFER = 512;
+
+/**
+ * @brief Runs an LSMStore lets pile up, while the background merger is busy,
+ * before inserts merge the smallest ones themselves.
+ */
+const int LSM_MAX_RUNS = 48;
+
+/**
+ * @brief Log-structured order-statistic store for insert-heavy workloads.
+ *
+ * Inserts go into a small sorted buffer. A full buffer is frozen into an
+ * immutable sorted run, and a background thread merges neighbouring runs
+ * until each run is more than twice the size of the next newer one. The
+ * merges are sequential passes, there are O(log n) runs, and no insert
+ * rebalances anything.
+ *
+ * Deletes are tombstones: a run keeps the values it added and the values
+ * it removed, and a value's multiplicity is its count among all runs'
+ * values minus its count among their tombstones. A merge cancels the
+ * values and tombstones the two runs share.
+ *
+ * Rank is a binary search per run, O(log^2 n). select() searches the runs
+ * together: it keeps a window of candidates in each run, ranks the
+ * weighted median of the windows' middle values, and narrows every window
+ * to the side of that pivot holding the answer. The values left of a
+ * window are all below any later pivot, so each rank only searches inside
+ * the windows, and each round drops at least a quarter of the candidates.
+ */
+class LSMStore
+{
+public:
+    LSMStore() : count(0), mergePending(false), stopping(false)
+    {
+        merger = thread([this]()
+                        { mergeLoop(); });
+    }
+
+    ~LSMStore()
+    {
+        {
+            lock_guard<mutex> guard(signalLock);
+            stopping = true;
+        }
+        signal.notify_one();
+        merger.join();
+    }
+
+    LSMStore(const LSMStore &) = delete;
+    LSMStore &operator=(const LSMStore &) = delete;
+
+    void insert(int value)
+    {
+        unique_lock<shared_mutex> exclusive(lock);
+        buffer.values.insert(upper_bound(buffer.values.begin(), buffer.values.end(), value), value);
+        count++;
+        if (buffer.size() >= (size_t)LSM_BUFFER)
+        {
+            flush();
+        }
+    }
+
+    void erase(int value)
+    {
+        unique_lock<shared_mutex> exclusive(lock);
+        if (countBelow(value, true) == countBelow(value, false))
+        {
+            return;
+        }
+        auto found = lower_bound(buffer.values.begin(), buffer.values.end(), value);
+        if (found != buffer.values.end() && *found == value)
+        {
+            buffer.values.erase(found);
+        }
+        else
+        {
+            buffer.tombstones.insert(upper_bound(buffer.tombstones.begin(), buffer.tombstones.end(), value), value);
+        }
+        count--;
+        if (buffer.size() >= (size_t)LSM_BUFFER)
+        {
+            flush();
+        }
+    }
+
+    bool select(int position, int &value) const
+    {
+        shared_lock<shared_mutex> shared(lock);
+        if (position < 1 || position > count)
+        {
+            return false;
+        }
+
+        // Candidates for the answer: windows[i] of the i-th run's values.
+        struct Window
+        {
+            const Run *run;
+            const int *low, *high;
+            const int *lowerBound, *upperBound;
+        };
+        vector<Window> windows;
+        for (size_t i = 0; i <= runs.size(); i++)
+        {
+            const Run *run = i < runs.size() ? runs[i].get() : &buffer;
+            const int *first = run->values.data();
+            windows.push_back({run, first, first + run->values.size(), first, first});
+        }
+
+        vector<pair<int, size_t>> middles;
+        while (true)
+        {
+            middles.clear();
+            size_t remaining = 0;
+            for (const Window &window : windows)
+            {
+                size_t length = window.high - window.low;
+                if (length > 0)
+                {
+                    middles.push_back({window.low[length / 2], length});
+                    remaining += length;
+                }
+            }
+            if (middles.empty())
+            {
+                return false;
+            }
+            sort(middles.begin(), middles.end());
+            int pivot = middles.back().first;
+            size_t weight = 0;
+            for (const pair<int, size_t> &middle : middles)
+            {
+                weight += middle.second;
+                if (2 * weight >= remaining)
+                {
+                    pivot = middle.first;
+                    break;
+                }
+            }
+
+            long long below = 0, through = 0;
+            for (Window &window : windows)
+            {
+                const int *first = window.run->values.data();
+                window.lowerBound = lower_bound(window.low, window.high, pivot);
+                window.upperBound = upper_bound(window.lowerBound, window.high, pivot);
+                below += window.lowerBound - first;
+                through += window.upperBound - first;
+                const vector<int> &tombstones = window.run->tombstones;
+                below -= lower_bound(tombstones.begin(), tombstones.end(), pivot) - tombstones.begin();
+                through -= upper_bound(tombstones.begin(), tombstones.end(), pivot) - tombstones.begin();
+            }
+            if (position > below && position <= through)
+            {
+                value = pivot;
+                return true;
+            }
+            for (Window &window : windows)
+            {
+                if (position > through)
+                {
+                    window.low = window.upperBound;
+                }
+                else
+                {
+                    window.high = window.lowerBound;
+                }
+            }
+        }
+    }
+
+    int getRank(int value) const
+    {
+        shared_lock<shared_mutex> shared(lock);
+        return countBelow(value, true);
+    }
+
+    int countLess(int value) const
+    {
+        shared_lock<shared_mutex> shared(lock);
+        return countBelow(value, false);
+    }
+
+    int countRange(int low, int high) const { return low > high ? 0 : getRank(high) - countLess(low); }
+
+    int size() const
+    {
+        shared_lock<shared_mutex> shared(lock);
+        return count;
+    }
+
+    /**
+     * @brief The number of sorted runs, not counting the buffer.
+     */
+    int runCount() const
+    {
+        shared_lock<shared_mutex> shared(lock);
+        return (int)runs.size();
+    }
+
+private:
+    struct Run
+    {
+        vector<int> values;
+        vector<int> tombstones;
+
+        size_t size() const { return values.size() + tombstones.size(); }
+    };
+
+    // The caller holds the lock.
+    int countBelow(int value, bool inclusive) const
+    {
+        auto countIn = [&](const vector<int> &sorted)
+        {
+            return (inclusive ? upper_bound(sorted.begin(), sorted.end(), value)
+                              : lower_bound(sorted.begin(), sorted.end(), value)) -
+                   sorted.begin();
+        };
+        long long rank = countIn(buffer.values) - countIn(buffer.tombstones);
+        for (const shared_ptr<const Run> &run : runs)
+        {
+            rank += countIn(run->values) - countIn(run->tombstones);
+        }
+        return (int)rank;
+    }
+
+    // Removes the values the two sorted vectors share, one copy at a time.
+    static void cancel(vector<int> &values, vector<int> &tombstones)
+    {
+        size_t v = 0, t = 0, keptValues = 0, keptTombstones = 0;
+        while (v < values.size() && t < tombstones.size())
+        {
+            if (values[v] < tombstones[t])
+            {
+                values[keptValues++] = values[v++];
+            }
+            else if (tombstones[t] < values[v])
+            {
+                tombstones[keptTombstones++] = tombstones[t++];
+            }
+            else
+            {
+                v++;
+                t++;
+            }
+        }
+        while (v < values.size())
+        {
+            values[keptValues++] = values[v++];
+        }
+        while (t < tombstones.size())
+        {
+            tombstones[keptTombstones++] = tombstones[t++];
+        }
+        values.resize(keptValues);
+        tombstones.resize(keptTombstones);
+    }
+
+    static shared_ptr<const Run> mergeRuns(const Run &older, const Run &newer)
+    {
+        shared_ptr<Run> merged = make_shared<Run>();
+        merged->values.resize(older.values.size() + newer.values.size());
+        merge(older.values.begin(), older.values.end(), newer.values.begin(), newer.values.end(),
+              merged->values.begin());
+        merged->tombstones.resize(older.tombstones.size() + newer.tombstones.size());
+        merge(older.tombstones.begin(), older.tombstones.end(), newer.tombstones.begin(), newer.tombstones.end(),
+              merged->tombstones.begin());
+        cancel(merged->values, merged->tombstones);
+        return merged;
+    }
+
+    // Freezes the buffer into the newest run. The lock is held exclusively.
+    void flush()
+    {
+        cancel(buffer.values, buffer.tombstones);
+        runs.push_back(make_shared<const Run>(move(buffer)));
+        buffer = Run();
+        // The merger fell behind: merge the smallest neighbours here.
+        while ((int)runs.size() > LSM_MAX_RUNS)
+        {
+            size_t best = 0;
+            for (size_t i = 1; i + 1 < runs.size(); i++)
+            {
+                if (runs[i]->size() + runs[i + 1]->size() < runs[best]->size() + runs[best + 1]->size())
+                {
+                    best = i;
+                }
+            }
+            runs[best] = mergeRuns(*runs[best], *runs[best + 1]);
+            runs.erase(runs.begin() + best + 1);
+        }
+        if (!mergePending.exchange(true))
+        {
+            lock_guard<mutex> guard(signalLock);
+            signal.notify_one();
+        }
+    }
+
+    // Merges the newest pair of neighbours whose older run is at most twice
+    // the newer one, outside the lock, and swaps the result in unless an
+    // insert merged either run meanwhile. Returns false when there is none.
+    bool mergeOnce()
+    {
+        shared_ptr<const Run> older, newer;
+        {
+            shared_lock<shared_mutex> shared(lock);
+            for (size_t i = runs.size(); i-- > 1;)
+            {
+                if (runs[i - 1]->size() <= 2 * runs[i]->size())
+                {
+                    older = runs[i - 1];
+                    newer = runs[i];
+                    break;
+                }
+            }
+        }
+        if (older == NULL)
+        {
+            return false;
+        }
+
+        shared_ptr<const Run> merged = mergeRuns(*older, *newer);
+        unique_lock<shared_mutex> exclusive(lock);
+        for (size_t i = 0; i + 1 < runs.size(); i++)
+        {
+            if (runs[i] == older && runs[i + 1] == newer)
+            {
+                runs[i] = merged;
+                runs.erase(runs.begin() + i + 1);
+                break;
+            }
+        }
+        return true;
+    }
+
+    void mergeLoop()
+    {
+        while (true)
+        {
+            {
+                unique_lock<mutex> guard(signalLock);
+                signal.wait(guard, [this]()
+                            { return mergePending.load() || stopping; });
+                if (stopping)
+                {
+                    return;
+                }
+            }
+            mergePending = false;
+            while (!stopping.load() && mergeOnce())
+            {
+            }
+        }
+    }
+
+    mutable shared_mutex lock;
+    Run buffer;
+    // Oldest (and largest) first.
+    vector<shared_ptr<const Run>> runs;
+    int count;
+
+    thread merger;
+    mutex signalLock;
+    condition_variable signal;
+    atomic<bool> mergePending;
+    atomic<bool> stopping;
+};
+
+#endif
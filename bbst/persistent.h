@@ -0,0 +1,469 @@
+/**
+ * @file persistent.h
+ * @brief Persistent AVL tree with versions readable during updates.
+ */
+
+#ifndef BBST_PERSISTENT_H
+#define BBST_PERSISTENT_H
+
+#include "common.h"
+
+/**
+ * @brief Immutable node of the persistent order-statistic tree.
+ *
+ * Nodes are shared between versions, so they are never modified once
+ * published; refs counts the parents and versions pointing at a node.
+ * As in Node, count is the multiplicity of the value and size counts copies.
+ */
+struct PersistentNode
+{
+    int value;
+    int count;
+    int height;
+    int size;
+    const PersistentNode *left;
+    const PersistentNode *right;
+    mutable atomic<int> refs;
+    PersistentNode *nextFree;
+};
+
+/**
+ * @brief Block allocator for persistent nodes.
+ *
+ * Every update copies O(log n) nodes, so nodes are carved out of large blocks
+ * and recycled through a free list instead of going through new/delete.
+ * Freed nodes arrive from whichever thread drops the last reference to a
+ * version, so the shared free list is locked; the single writer refills a
+ * private list in batches to keep the lock off the copy path.
+ */
+class PersistentNodePool
+{
+public:
+    PersistentNodePool() : sharedFree(NULL), localFree(NULL) {}
+    ~PersistentNodePool()
+    {
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            delete[] blocks[i];
+        }
+    }
+    PersistentNodePool(const PersistentNodePool &) = delete;
+    PersistentNodePool &operator=(const PersistentNodePool &) = delete;
+
+    /**
+     * @brief Take a node from the pool. Writer side only.
+     */
+    PersistentNode *allocate()
+    {
+        if (localFree == NULL)
+        {
+            lock_guard<mutex> guard(lock);
+            if (sharedFree != NULL)
+            {
+                localFree = sharedFree;
+                sharedFree = NULL;
+            }
+            else
+            {
+                PersistentNode *block = new PersistentNode[BLOCK_SIZE];
+                blocks.push_back(block);
+                for (int i = 0; i < BLOCK_SIZE; i++)
+                {
+                    block[i].nextFree = i + 1 < BLOCK_SIZE ? &block[i + 1] : NULL;
+                }
+                localFree = block;
+            }
+        }
+        PersistentNode *node = localFree;
+        localFree = node->nextFree;
+        return node;
+    }
+
+    /**
+     * @brief Return a chain of nodes linked through nextFree. Any thread.
+     */
+    void freeChain(PersistentNode *head, PersistentNode *tail)
+    {
+        lock_guard<mutex> guard(lock);
+        tail->nextFree = sharedFree;
+        sharedFree = head;
+    }
+
+private:
+    static constexpr int BLOCK_SIZE = 4096;
+
+    mutex lock;
+    vector<PersistentNode *> blocks;
+    PersistentNode *sharedFree;
+    PersistentNode *localFree;
+};
+
+/**
+ * @brief Persistent (path-copying) AVL order-statistic tree.
+ *
+ * insert() and erase() never touch a published node: they copy the O(log n)
+ * nodes on the search path, rebalance the copies, and atomically publish the
+ * new root as a new version. Readers call snapshot() to pin the current
+ * version and then run select/rank against it without any locking, while
+ * writers keep going. A version, and every node only it references, goes back
+ * to the pool when its last snapshot is dropped.
+ *
+ * Writers are serialized among themselves.
+ */
+class PersistentTree
+{
+private:
+    struct Version
+    {
+        Version(const PersistentNode *root, PersistentTree *owner) : root(root), owner(owner) {}
+        ~Version() { owner->release(root); }
+
+        const PersistentNode *root;
+        PersistentTree *owner;
+    };
+
+public:
+    /**
+     * @brief A pinned, immutable version of the tree. Cheap to copy.
+     */
+    class Snapshot
+    {
+    public:
+        Snapshot(shared_ptr<const Version> version) : version(version) {}
+
+        int size() const { return nodeSize(version->root); }
+
+        bool select(int position, int &value) const
+        {
+            if (position < 1 || position > size())
+            {
+                return false;
+            }
+            const PersistentNode *node = version->root;
+            while (true)
+            {
+                int myPosition = nodeSize(node->left) + 1;
+                int lastPosition = nodeSize(node->left) + node->count;
+                if (position > lastPosition)
+                {
+                    position -= lastPosition;
+                    node = node->right;
+                }
+                else if (position < myPosition)
+                {
+                    node = node->left;
+                }
+                else
+                {
+                    value = node->value;
+                    return true;
+                }
+            }
+        }
+
+        int getRank(int value) const
+        {
+            int count = 0;
+            for (const PersistentNode *node = version->root; node != NULL;)
+            {
+                if (value >= node->value)
+                {
+                    count += nodeSize(node->left) + node->count;
+                    node = node->right;
+                }
+                else
+                {
+                    node = node->left;
+                }
+            }
+            return count;
+        }
+
+        int countLess(int value) const
+        {
+            int count = 0;
+            for (const PersistentNode *node = version->root; node != NULL;)
+            {
+                if (value > node->value)
+                {
+                    count += nodeSize(node->left) + node->count;
+                    node = node->right;
+                }
+                else
+                {
+                    node = node->left;
+                }
+            }
+            return count;
+        }
+
+        int countRange(int low, int high) const
+        {
+            if (low > high)
+            {
+                return 0;
+            }
+            return getRank(high) - countLess(low);
+        }
+
+        bool contains(int value) const
+        {
+            for (const PersistentNode *node = version->root; node != NULL;)
+            {
+                if (value == node->value)
+                {
+                    return true;
+                }
+                node = value < node->value ? node->left : node->right;
+            }
+            return false;
+        }
+
+    private:
+        shared_ptr<const Version> version;
+    };
+
+    PersistentTree()
+    {
+        atomic_store(&current, shared_ptr<const Version>(new Version(NULL, this)));
+    }
+    ~PersistentTree()
+    {
+        // Outstanding snapshots must not outlive the tree (they return nodes to its pool).
+        atomic_store(&current, shared_ptr<const Version>());
+    }
+    PersistentTree(const PersistentTree &) = delete;
+    PersistentTree &operator=(const PersistentTree &) = delete;
+
+    /**
+     * @brief Pin the latest published version.
+     */
+    Snapshot snapshot() const { return Snapshot(atomic_load(&current)); }
+
+    void insert(int value)
+    {
+        lock_guard<mutex> guard(writerLock);
+        shared_ptr<const Version> base = atomic_load(&current);
+        publish(insertInto(base->root, value));
+    }
+
+    void erase(int value)
+    {
+        lock_guard<mutex> guard(writerLock);
+        shared_ptr<const Version> base = atomic_load(&current);
+        // Skipping the copy avoids publishing an identical version.
+        if (!Snapshot(base).contains(value))
+        {
+            return;
+        }
+        publish(eraseFrom(base->root, value));
+    }
+
+    // Single-query conveniences, each against the latest version.
+    int size() const { return snapshot().size(); }
+    bool select(int position, int &value) const { return snapshot().select(position, value); }
+    int getRank(int value) const { return snapshot().getRank(value); }
+    int countLess(int value) const { return snapshot().countLess(value); }
+    int countRange(int low, int high) const { return snapshot().countRange(low, high); }
+
+private:
+    static int nodeHeight(const PersistentNode *node) { return node == NULL ? 0 : node->height; }
+    static int nodeSize(const PersistentNode *node) { return node == NULL ? 0 : node->size; }
+
+    static const PersistentNode *retain(const PersistentNode *node)
+    {
+        if (node != NULL)
+        {
+            node->refs.fetch_add(1, memory_order_relaxed);
+        }
+        return node;
+    }
+
+    /**
+     * @brief Drop one reference; nodes reaching zero are collected and
+     * handed back to the pool in a single batch.
+     */
+    void release(const PersistentNode *node)
+    {
+        PersistentNode *head = NULL, *tail = NULL;
+        vector<const PersistentNode *> pending;
+        if (node != NULL)
+        {
+            pending.push_back(node);
+        }
+        while (!pending.empty())
+        {
+            const PersistentNode *top = pending.back();
+            pending.pop_back();
+            if (top->refs.fetch_sub(1, memory_order_acq_rel) != 1)
+            {
+                continue;
+            }
+            if (top->left != NULL)
+            {
+                pending.push_back(top->left);
+            }
+            if (top->right != NULL)
+            {
+                pending.push_back(top->right);
+            }
+            PersistentNode *freed = const_cast<PersistentNode *>(top);
+            freed->nextFree = head;
+            head = freed;
+            if (tail == NULL)
+            {
+                tail = freed;
+            }
+        }
+        if (head != NULL)
+        {
+            pool.freeChain(head, tail);
+        }
+    }
+
+    /**
+     * @brief Build a node; takes over the references held on left and right.
+     */
+    const PersistentNode *makeNode(int value, int count, const PersistentNode *left,
+                                   const PersistentNode *right)
+    {
+        PersistentNode *node = pool.allocate();
+        node->value = value;
+        node->count = count;
+        node->left = left;
+        node->right = right;
+        node->height = max(nodeHeight(left), nodeHeight(right)) + 1;
+        node->size = nodeSize(left) + nodeSize(right) + count;
+        node->refs.store(1, memory_order_relaxed);
+        return node;
+    }
+
+    /**
+     * @brief makeNode() that restores the AVL property with a single or
+     * double rotation when the two subtrees differ in height by two.
+     * The rotated-away node is released, not modified.
+     */
+    const PersistentNode *balanceNode(int value, int count, const PersistentNode *left,
+                                      const PersistentNode *right)
+    {
+        if (nodeHeight(left) > nodeHeight(right) + 1)
+        {
+            const PersistentNode *result;
+            // Left Left Rotation
+            if (nodeHeight(left->left) >= nodeHeight(left->right))
+            {
+                result = makeNode(left->value, left->count, retain(left->left),
+                                  makeNode(value, count, retain(left->right), right));
+            }
+            // Left Right Rotation
+            else
+            {
+                const PersistentNode *pivot = left->right;
+                result = makeNode(pivot->value, pivot->count,
+                                  makeNode(left->value, left->count, retain(left->left), retain(pivot->left)),
+                                  makeNode(value, count, retain(pivot->right), right));
+            }
+            release(left);
+            return result;
+        }
+
+        if (nodeHeight(right) > nodeHeight(left) + 1)
+        {
+            const PersistentNode *result;
+            // Right Right Rotation
+            if (nodeHeight(right->right) >= nodeHeight(right->left))
+            {
+                result = makeNode(right->value, right->count,
+                                  makeNode(value, count, left, retain(right->left)),
+                                  retain(right->right));
+            }
+            // Right Left Rotation
+            else
+            {
+                const PersistentNode *pivot = right->left;
+                result = makeNode(pivot->value, pivot->count,
+                                  makeNode(value, count, left, retain(pivot->left)),
+                                  makeNode(right->value, right->count, retain(pivot->right),
+                                           retain(right->right)));
+            }
+            release(right);
+            return result;
+        }
+
+        return makeNode(value, count, left, right);
+    }
+
+    // Path-copying insert of one copy. Returns an owned reference.
+    const PersistentNode *insertInto(const PersistentNode *node, int value)
+    {
+        if (node == NULL)
+        {
+            return makeNode(value, 1, NULL, NULL);
+        }
+        if (value < node->value)
+        {
+            return balanceNode(node->value, node->count, insertInto(node->left, value),
+                               retain(node->right));
+        }
+        if (value > node->value)
+        {
+            return balanceNode(node->value, node->count, retain(node->left),
+                               insertInto(node->right, value));
+        }
+        return makeNode(node->value, node->count + 1, retain(node->left), retain(node->right));
+    }
+
+    // Path-copying removal of the smallest node. Returns an owned reference.
+    const PersistentNode *eraseMin(const PersistentNode *node, int &minValue, int &minCount)
+    {
+        if (node->left == NULL)
+        {
+            minValue = node->value;
+            minCount = node->count;
+            return retain(node->right);
+        }
+        return balanceNode(node->value, node->count, eraseMin(node->left, minValue, minCount),
+                           retain(node->right));
+    }
+
+    // Path-copying erase of one copy of a value known to be present. Returns an owned reference.
+    const PersistentNode *eraseFrom(const PersistentNode *node, int value)
+    {
+        if (value < node->value)
+        {
+            return balanceNode(node->value, node->count, eraseFrom(node->left, value),
+                               retain(node->right));
+        }
+        if (value > node->value)
+        {
+            return balanceNode(node->value, node->count, retain(node->left),
+                               eraseFrom(node->right, value));
+        }
+        if (node->count > 1)
+        {
+            return makeNode(node->value, node->count - 1, retain(node->left), retain(node->right));
+        }
+        if (node->left == NULL)
+        {
+            return retain(node->right);
+        }
+        if (node->right == NULL)
+        {
+            return retain(node->left);
+        }
+        int successor, successorCount;
+        const PersistentNode *right = eraseMin(node->right, successor, successorCount);
+        return balanceNode(successor, successorCount, retain(node->left), right);
+    }
+
+    void publish(const PersistentNode *root)
+    {
+        atomic_store(&current, shared_ptr<const Version>(new Version(root, this)));
+    }
+
+    PersistentNodePool pool;
+    mutex writerLock;
+    shared_ptr<const Version> current;
+};
+
+#endif
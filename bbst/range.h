@@ -0,0 +1,466 @@
+/**
+ * @file range.h
+ * @brief Range order statistics: wavelet matrix and persistent segment tree.
+ */
+
+#ifndef BBST_RANGE_H
+#define BBST_RANGE_H
+
+#include "common.h"
+#include "avl.h"
+
+/**
+ * @brief The number of set bits in a word.
+ */
+inline int popcount64(uint64_t word)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((word * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+ * @brief A fixed bit-vector with constant time rank: the bits are packed in
+ * 64-bit words, and every block of 512 bits stores the number of ones
+ * before it (about 6% on top of the bits). rank1() is one block count plus
+ * at most eight popcounts within the block.
+ */
+class RankBitVector
+{
+public:
+    void resize(size_t bits)
+    {
+        words.assign(bits / 64 + 1, 0);
+        blocks.clear();
+    }
+
+    void set(size_t index) { words[index / 64] |= 1ULL << (index % 64); }
+    bool get(size_t index) const { return (words[index / 64] >> (index % 64)) & 1; }
+
+    // Call once every bit is set, before rank1().
+    void buildRanks()
+    {
+        blocks.assign(words.size() / 8 + 1, 0);
+        uint32_t ones = 0;
+        for (size_t w = 0; w < words.size(); w++)
+        {
+            if (w % 8 == 0)
+            {
+                blocks[w / 8] = ones;
+            }
+            ones += popcount64(words[w]);
+        }
+    }
+
+    // The number of ones among the first `index` bits.
+    size_t rank1(size_t index) const
+    {
+        size_t word = index / 64;
+        size_t ones = blocks[word / 8];
+        for (size_t w = word & ~(size_t)7; w < word; w++)
+        {
+            ones += popcount64(words[w]);
+        }
+        return ones + popcount64(words[word] & ((1ULL << (index % 64)) - 1));
+    }
+
+    size_t rank0(size_t index) const { return index - rank1(index); }
+
+private:
+    vector<uint64_t> words;
+    vector<uint32_t> blocks;
+};
+
+/**
+ * @brief Range order statistics over a static sequence: a wavelet matrix.
+ *
+ * The values are first replaced by their index among the sorted distinct
+ * values (sigma of them), which needs L = ceil(log2 sigma) bits. Level l
+ * stores bit l (from the top) of every code, with the codes stably sorted
+ * by their higher bits, zeros before ones. A range of positions maps to a
+ * range on each level with two rank queries, so both queries below take
+ * O(log sigma) time, and the structure is about n log sigma bits plus the
+ * rank blocks and the sorted distinct values.
+ */
+class WaveletMatrix
+{
+public:
+    WaveletMatrix() : length(0) {}
+
+    void build(const vector<int> &values)
+    {
+        length = values.size();
+        alphabet = values;
+        sort(alphabet.begin(), alphabet.end());
+        alphabet.erase(unique(alphabet.begin(), alphabet.end()), alphabet.end());
+
+        int levelCount = 1;
+        while (levelCount < 31 && ((size_t)1 << levelCount) < alphabet.size())
+        {
+            levelCount++;
+        }
+        vector<uint32_t> codes(length), next(length);
+        for (size_t i = 0; i < length; i++)
+        {
+            codes[i] = lower_bound(alphabet.begin(), alphabet.end(), values[i]) - alphabet.begin();
+        }
+
+        levels.assign(levelCount, RankBitVector());
+        zeros.assign(levelCount, 0);
+        for (int l = 0; l < levelCount; l++)
+        {
+            int bit = levelCount - 1 - l;
+            levels[l].resize(length);
+            size_t zeroCount = 0;
+            for (size_t i = 0; i < length; i++)
+            {
+                if ((codes[i] >> bit) & 1)
+                {
+                    levels[l].set(i);
+                }
+                else
+                {
+                    zeroCount++;
+                }
+            }
+            levels[l].buildRanks();
+            zeros[l] = zeroCount;
+
+            // Stable partition for the next level: zeros, then ones.
+            size_t zeroAt = 0, oneAt = zeroCount;
+            for (size_t i = 0; i < length; i++)
+            {
+                next[((codes[i] >> bit) & 1) ? oneAt++ : zeroAt++] = codes[i];
+            }
+            codes.swap(next);
+        }
+    }
+
+    /**
+     * @brief The k-th smallest value among positions [left, right).
+     *
+     * @param left First position, 0-based.
+     * @param right One past the last position.
+     * @param k 1-based, at most right - left.
+     * @param value Receives the value.
+     * @return bool False when the range or k is out of bounds.
+     */
+    bool rangeQuantile(size_t left, size_t right, size_t k, int &value) const
+    {
+        if (left >= right || right > length || k < 1 || k > right - left)
+        {
+            return false;
+        }
+        uint32_t code = 0;
+        for (size_t l = 0; l < levels.size(); l++)
+        {
+            size_t zeroLeft = levels[l].rank0(left), zeroRight = levels[l].rank0(right);
+            size_t zeroesInRange = zeroRight - zeroLeft;
+            code <<= 1;
+            if (k <= zeroesInRange)
+            {
+                left = zeroLeft;
+                right = zeroRight;
+            }
+            else
+            {
+                k -= zeroesInRange;
+                code |= 1;
+                left = zeros[l] + (left - zeroLeft);
+                right = zeros[l] + (right - zeroRight);
+            }
+        }
+        value = alphabet[code];
+        return true;
+    }
+
+    /**
+     * @brief The number of values <= x among positions [left, right).
+     */
+    size_t rangeRank(size_t left, size_t right, int x) const
+    {
+        right = min(right, length);
+        if (left >= right)
+        {
+            return 0;
+        }
+        // Count the codes below `bound`, the number of distinct values <= x.
+        size_t bound = upper_bound(alphabet.begin(), alphabet.end(), x) - alphabet.begin();
+        if (bound >= alphabet.size())
+        {
+            return right - left;
+        }
+        size_t below = 0;
+        for (size_t l = 0; l < levels.size(); l++)
+        {
+            int bit = (int)(levels.size() - 1 - l);
+            size_t zeroLeft = levels[l].rank0(left), zeroRight = levels[l].rank0(right);
+            if ((bound >> bit) & 1)
+            {
+                // Every code with a 0 here (and the same higher bits) is smaller.
+                below += zeroRight - zeroLeft;
+                left = zeros[l] + (left - zeroLeft);
+                right = zeros[l] + (right - zeroRight);
+            }
+            else
+            {
+                left = zeroLeft;
+                right = zeroRight;
+            }
+        }
+        return below;
+    }
+
+    size_t size() const { return length; }
+
+private:
+    size_t length;
+    vector<int> alphabet;
+    vector<RankBitVector> levels;
+    vector<size_t> zeros;
+};
+
+/**
+ * @brief Range order statistics over a static sequence: a persistent
+ * segment tree with one version per prefix.
+ *
+ * The values are coordinate compressed to codes 0..m-1 and the tree spans
+ * the codes, padded to a power of two 2^L. Version p counts the codes of
+ * the first p values; it shares all but the L + 1 nodes on one root-to-leaf
+ * path with version p - 1. Subtracting version i from version j gives the
+ * counts of positions i..j-1, so a k-th smallest or rank query is one
+ * descent of both versions, O(log n), over n (L + 1) + 1 nodes.
+ *
+ * The build is parallel by value range: with 2^D threads, subtree r at
+ * depth D only changes when a value with code in its range arrives, so
+ * thread r builds the versions of that subtree from those values alone,
+ * into its own precomputed slice of the node array (every path has the same
+ * length). A sequential pass then copies the top D levels per prefix.
+ */
+class PersistentSegmentTree
+{
+public:
+    PersistentSegmentTree() : length(0), levels(0) {}
+
+    /**
+     * @param values The sequence.
+     * @param threads Worker threads; 0 for one per hardware thread.
+     */
+    void build(const vector<int> &values, int threads = 0)
+    {
+        length = values.size();
+        alphabet = values;
+        sort(alphabet.begin(), alphabet.end());
+        alphabet.erase(unique(alphabet.begin(), alphabet.end()), alphabet.end());
+        levels = 0;
+        while (((size_t)1 << levels) < alphabet.size())
+        {
+            levels++;
+        }
+        vector<uint32_t> codes(length);
+        for (size_t i = 0; i < length; i++)
+        {
+            codes[i] = lower_bound(alphabet.begin(), alphabet.end(), values[i]) - alphabet.begin();
+        }
+
+        // 2^split subtrees, one per thread, each worth building in parallel.
+        if (threads <= 0)
+        {
+            threads = (int)max(thread::hardware_concurrency(), 1u);
+        }
+        int split = 0;
+        while (split < levels && (2 << split) <= threads && (length >> (split + 1)) >= (size_t)PARALLEL_GRAIN)
+        {
+            split++;
+        }
+        int lower = levels - split;
+        int parts = 1 << split;
+
+        // Positions grouped by subtree, in arrival order.
+        vector<size_t> starts(parts + 1, 0);
+        for (size_t i = 0; i < length; i++)
+        {
+            starts[(codes[i] >> lower) + 1]++;
+        }
+        for (int r = 0; r < parts; r++)
+        {
+            starts[r + 1] += starts[r];
+        }
+        vector<uint32_t> order(length);
+        vector<size_t> fill(starts.begin(), starts.end() - 1);
+        for (size_t i = 0; i < length; i++)
+        {
+            order[fill[codes[i] >> lower]++] = (uint32_t)i;
+        }
+
+        // Node 0 is the empty tree; subtree r's paths fill its own slice.
+        nodes.assign(1 + length * (levels + 1), SegmentNode());
+        vector<uint32_t> subtreeRoots(length);
+        auto buildPart = [&](int r)
+        {
+            uint32_t next = (uint32_t)(1 + starts[r] * (lower + 1));
+            uint32_t previous = 0;
+            for (size_t at = starts[r]; at < starts[r + 1]; at++)
+            {
+                uint32_t code = codes[order[at]];
+                subtreeRoots[order[at]] = next;
+                uint32_t old = previous;
+                previous = next;
+                for (int bit = lower - 1; bit >= 0; bit--, next++)
+                {
+                    nodes[next] = nodes[old];
+                    nodes[next].count++;
+                    if ((code >> bit) & 1)
+                    {
+                        old = nodes[old].right;
+                        nodes[next].right = next + 1;
+                    }
+                    else
+                    {
+                        old = nodes[old].left;
+                        nodes[next].left = next + 1;
+                    }
+                }
+                nodes[next] = nodes[old];
+                nodes[next++].count++;
+            }
+        };
+        if (parts == 1)
+        {
+            buildPart(0);
+        }
+        else
+        {
+            vector<thread> workers;
+            for (int r = 0; r < parts; r++)
+            {
+                workers.emplace_back(buildPart, r);
+            }
+            for (size_t t = 0; t < workers.size(); t++)
+            {
+                workers[t].join();
+            }
+        }
+
+        // The top levels, copied per prefix down to the new subtree version.
+        roots.assign(length + 1, 0);
+        uint32_t next = (uint32_t)(1 + length * (lower + 1));
+        for (size_t i = 0; i < length; i++)
+        {
+            uint32_t part = codes[i] >> lower;
+            uint32_t old = roots[i];
+            roots[i + 1] = split > 0 ? next : subtreeRoots[i];
+            for (int bit = split - 1; bit >= 0; bit--, next++)
+            {
+                nodes[next] = nodes[old];
+                nodes[next].count++;
+                uint32_t child = bit > 0 ? next + 1 : subtreeRoots[i];
+                if ((part >> bit) & 1)
+                {
+                    old = nodes[old].right;
+                    nodes[next].right = child;
+                }
+                else
+                {
+                    old = nodes[old].left;
+                    nodes[next].left = child;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief The k-th smallest value among positions [left, right).
+     *
+     * @param left First position, 0-based.
+     * @param right One past the last position.
+     * @param k 1-based, at most right - left.
+     * @param value Receives the value.
+     * @return bool False when the range or k is out of bounds.
+     */
+    bool rangeQuantile(size_t left, size_t right, size_t k, int &value) const
+    {
+        if (left >= right || right > length || k < 1 || k > right - left)
+        {
+            return false;
+        }
+        uint32_t before = roots[left], after = roots[right];
+        uint32_t code = 0;
+        for (int bit = levels - 1; bit >= 0; bit--)
+        {
+            size_t leftCount = nodes[nodes[after].left].count - nodes[nodes[before].left].count;
+            if (k <= leftCount)
+            {
+                before = nodes[before].left;
+                after = nodes[after].left;
+            }
+            else
+            {
+                k -= leftCount;
+                code |= 1u << bit;
+                before = nodes[before].right;
+                after = nodes[after].right;
+            }
+        }
+        value = alphabet[code];
+        return true;
+    }
+
+    /**
+     * @brief The number of values <= x among positions [left, right).
+     */
+    size_t rangeRank(size_t left, size_t right, int x) const
+    {
+        right = min(right, length);
+        if (left >= right)
+        {
+            return 0;
+        }
+        // Count the codes below `bound`, the number of distinct values <= x.
+        size_t bound = upper_bound(alphabet.begin(), alphabet.end(), x) - alphabet.begin();
+        if (bound >= alphabet.size())
+        {
+            return right - left;
+        }
+        uint32_t before = roots[left], after = roots[right];
+        size_t below = 0;
+        for (int bit = levels - 1; bit >= 0; bit--)
+        {
+            if ((bound >> bit) & 1)
+            {
+                below += nodes[nodes[after].left].count - nodes[nodes[before].left].count;
+                before = nodes[before].right;
+                after = nodes[after].right;
+            }
+            else
+            {
+                before = nodes[before].left;
+                after = nodes[after].left;
+            }
+        }
+        return below;
+    }
+
+    size_t size() const { return length; }
+
+private:
+    struct SegmentNode
+    {
+        SegmentNode() : left(0), right(0), count(0) {}
+        uint32_t left, right, count;
+    };
+
+    size_t length;
+    int levels;
+    vector<int> alphabet;
+    vector<SegmentNode> nodes;
+    // roots[p] is the version holding the first p values.
+    vector<uint32_t> roots;
+};
+
+#endif
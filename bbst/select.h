@@ -0,0 +1,322 @@
+/**
+ * @file select.h
+ * @brief Selection on plain arrays: median of medians, Floyd-Rivest and
+ * parallel selection.
+ */
+
+#ifndef BBST_SELECT_H
+#define BBST_SELECT_H
+
+#include "common.h"
+
+/**
+ * @brief Selection by median of medians: the k-th smallest of values[left..right]
+ * in guaranteed O(n) time, left in values[k]. Slower in practice than
+ * floydRivestSelect(), which falls back to it on adversarial inputs.
+ *
+ * @param values The array; reordered in place.
+ * @param left First index of the range.
+ * @param right Last index of the range.
+ * @param k Zero-based target index, left <= k <= right.
+ */
+inline void medianOfMediansSelect(vector<int> &values, int left, int right, int k)
+{
+    while (right - left >= 5)
+    {
+        // Gather the median of each group of five at the front of the range.
+        int medians = left;
+        for (int group = left; group <= right; group += 5)
+        {
+            int groupEnd = min(group + 4, right);
+            sort(values.begin() + group, values.begin() + groupEnd + 1);
+            swap(values[medians++], values[group + (groupEnd - group) / 2]);
+        }
+        int middle = left + (medians - left - 1) / 2;
+        medianOfMediansSelect(values, left, medians - 1, middle);
+        int pivot = values[middle];
+
+        // Three-way partition: < pivot | == pivot | > pivot.
+        int lessEnd = left, index = left, greaterStart = right + 1;
+        while (index < greaterStart)
+        {
+            if (values[index] < pivot)
+            {
+                swap(values[lessEnd++], values[index++]);
+            }
+            else if (values[index] > pivot)
+            {
+                swap(values[index], values[--greaterStart]);
+            }
+            else
+            {
+                index++;
+            }
+        }
+
+        if (k < lessEnd)
+        {
+            right = lessEnd - 1;
+        }
+        else if (k >= greaterStart)
+        {
+            left = greaterStart;
+        }
+        else
+        {
+            return;
+        }
+    }
+    sort(values.begin() + left, values.begin() + right + 1);
+}
+
+/**
+ * @brief Floyd-Rivest selection, introselect style: the k-th smallest of
+ * values[left..right] ends up in values[k], with smaller values before it and
+ * larger ones after.
+ *
+ * On large ranges a small sample is selected recursively first, picking two
+ * pivots that bracket k tightly, so each partition pass discards almost all
+ * of the range: about n + min(k, n - k) comparisons on average. If a range
+ * refuses to shrink (more passes than 2 log2(n) + 8) the remaining work is
+ * handed to medianOfMediansSelect(), which keeps the worst case linear.
+ *
+ * @param values The array; reordered in place.
+ * @param left First index of the range.
+ * @param right Last index of the range.
+ * @param k Zero-based target index, left <= k <= right.
+ */
+inline void floydRivestSelect(vector<int> &values, int left, int right, int k)
+{
+    int passesLeft = 8;
+    for (int n = right - left + 1; n > 1; n >>= 1)
+    {
+        passesLeft += 2;
+    }
+
+    while (right > left)
+    {
+        if (passesLeft-- == 0)
+        {
+            medianOfMediansSelect(values, left, right, k);
+            return;
+        }
+
+        if (right - left > 600)
+        {
+            // Narrow to a sample range expected to contain the k-th value.
+            double n = right - left + 1;
+            double i = k - left + 1;
+            double z = log(n);
+            double s = 0.5 * exp(2 * z / 3);
+            double sd = 0.5 * sqrt(z * s * (n - s) / n) * (i - n / 2 < 0 ? -1 : 1);
+            int newLeft = max(left, (int)(k - i * s / n + sd));
+            int newRight = min(right, (int)(k + (n - i) * s / n + sd));
+            floydRivestSelect(values, newLeft, newRight, k);
+        }
+
+        // Partition around t = values[k].
+        int t = values[k];
+        int i = left;
+        int j = right;
+        swap(values[left], values[k]);
+        if (values[right] > t)
+        {
+            swap(values[right], values[left]);
+        }
+        while (i < j)
+        {
+            swap(values[i], values[j]);
+            i++;
+            j--;
+            while (values[i] < t)
+            {
+                i++;
+            }
+            while (values[j] > t)
+            {
+                j--;
+            }
+        }
+        if (values[left] == t)
+        {
+            swap(values[left], values[j]);
+        }
+        else
+        {
+            j++;
+            swap(values[j], values[right]);
+        }
+
+        // values[j] == t is now in its final place.
+        if (j <= k)
+        {
+            left = j + 1;
+        }
+        if (k <= j)
+        {
+            right = j - 1;
+        }
+    }
+}
+
+/**
+ * @brief One-shot order statistic without a tree: the position-th smallest
+ * value (1-based) of an array, in expected linear time.
+ *
+ * @param values The array; reordered in place.
+ * @param position The 1-based position.
+ * @param result Receives the value.
+ * @return bool False when the position is out of range.
+ */
+inline bool selectInPlace(vector<int> &values, int position, int &result)
+{
+    if (position < 1 || position > (int)values.size())
+    {
+        return false;
+    }
+    floydRivestSelect(values, 0, (int)values.size() - 1, position - 1);
+    result = values[position - 1];
+    return true;
+}
+
+/**
+ * @brief Arrays smaller than this are selected on one core; below it the
+ * threads cost more than the pass they save.
+ */
+const int PARALLEL_SELECT_MIN = 1 << 22;
+
+/**
+ * @brief Parallel selection for large arrays.
+ *
+ * 1. Sort a random sample of about n^(2/3) values and take the two sample
+ *    values a few standard deviations either side of the target's expected
+ *    place in the sample; they bracket the k-th value with high probability.
+ * 2. Every thread counts, over its slice, the values below the lower pivot
+ *    and the values between the pivots.
+ * 3. If the k-th value falls between the pivots (the usual case), every
+ *    thread copies its in-band values to its own offset of a small candidate
+ *    array, found from the prefix sums of the counts.
+ * 4. Select the remaining rank in the candidates, which are a vanishing
+ *    fraction of the input.
+ * That is two parallel passes over the data. A rare miss widens the bracket
+ * and tries again. A bracket end that falls off the sample (always, on the
+ * last widening) is left open, INT_MIN or INT_MAX, so positions near 1 or n
+ * are bracketed at once and the last bracket holds every value. A band
+ * holding more than half the values (heavy duplication, or the open last
+ * bracket) is not copied: the array is selected in place on one core.
+ *
+ * @param values The array; reordered only by that in-place fallback.
+ * @param position The 1-based position.
+ * @param threads The number of worker threads.
+ * @param result Receives the value.
+ * @return bool False when the position is out of range.
+ */
+inline bool parallelSelect(vector<int> &values, int position, int threads, int &result)
+{
+    int n = (int)values.size();
+    if (position < 1 || position > n)
+    {
+        return false;
+    }
+
+    mt19937 generator(n);
+    int sampleSize = max(1024, (int)pow((double)n, 2.0 / 3.0));
+    vector<int> sample(sampleSize);
+    for (int i = 0; i < sampleSize; i++)
+    {
+        sample[i] = values[generator() % n];
+    }
+    sort(sample.begin(), sample.end());
+
+    // Where the target should sit in the sample, and a margin of about
+    // three standard deviations of that estimate (at least 0.5 sqrt(s) each).
+    double expected = (double)position / n * sampleSize;
+    for (double margin = 3 * sqrt((double)sampleSize); margin < 4 * sampleSize; margin *= 4)
+    {
+        int lowIndex = (int)max(0.0, expected - margin);
+        int highIndex = (int)min(sampleSize - 1.0, expected + margin);
+        int low = lowIndex == 0 ? INT_MIN : sample[lowIndex];
+        int high = highIndex == sampleSize - 1 ? INT_MAX : sample[highIndex];
+
+        // Pass 1: count below and inside [low, high] per slice.
+        vector<long long> below(threads), inside(threads);
+        vector<thread> workers;
+        long long slice = ((long long)n + threads - 1) / threads;
+        for (int t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t]()
+                                 {
+                long long begin = t * slice, end = min((long long)n, begin + slice);
+                long long less = 0, band = 0;
+                for (long long i = begin; i < end; i++)
+                {
+                    int value = values[i];
+                    less += value < low;
+                    band += value >= low && value <= high;
+                }
+                below[t] = less;
+                inside[t] = band; });
+        }
+        for (size_t t = 0; t < workers.size(); t++)
+        {
+            workers[t].join();
+        }
+
+        long long totalBelow = 0, totalInside = 0;
+        vector<long long> offsets(threads);
+        for (int t = 0; t < threads; t++)
+        {
+            totalBelow += below[t];
+            offsets[t] = totalInside;
+            totalInside += inside[t];
+        }
+        if (position <= totalBelow || position > totalBelow + totalInside)
+        {
+            // The bracket missed the target: widen it.
+            continue;
+        }
+        if (low == high)
+        {
+            result = low;
+            return true;
+        }
+        if (totalInside > n / 2)
+        {
+            // Compacting would copy most of the array.
+            return selectInPlace(values, position, result);
+        }
+
+        // Pass 2: compact the band.
+        vector<int> band(totalInside);
+        workers.clear();
+        for (int t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t]()
+                                 {
+                long long begin = t * slice, end = min((long long)n, begin + slice);
+                int *out = band.data() + offsets[t];
+                for (long long i = begin; i < end; i++)
+                {
+                    int value = values[i];
+                    if (value >= low && value <= high)
+                    {
+                        *out++ = value;
+                    }
+                } });
+        }
+        for (size_t t = 0; t < workers.size(); t++)
+        {
+            workers[t].join();
+        }
+
+        int rank = (int)(position - totalBelow);
+        floydRivestSelect(band, 0, (int)band.size() - 1, rank - 1);
+        result = band[rank - 1];
+        return true;
+    }
+
+    // Not reached: the last bracket is open at both ends, so it holds the target.
+    return selectInPlace(values, position, result);
+}
+
+#endif
@@ -0,0 +1,266 @@
+/**
+ * @file sharded.h
+ * @brief Key-range sharded AVL index with background rebalancing.
+ */
+
+#ifndef BBST_SHARDED_H
+#define BBST_SHARDED_H
+
+#include "common.h"
+#include "avl.h"
+
+/**
+ * @brief A shard may grow to twice the average shard size plus this many
+ * values before the background rebalance is started.
+ */
+const int SHARD_SLACK = 1024;
+
+/**
+ * @brief Order-statistic index split into S key-range shards, each an AVL
+ * tree behind its own lock, so threads inserting into different ranges do
+ * not contend.
+ *
+ * Shard s holds the keys in [splitters[s - 1], splitters[s]). The splitters
+ * come from a sample (configure()), or split the int range evenly until the
+ * first rebalance. A global select walks the shard sizes (a prefix sum,
+ * O(S)) to find the shard holding the position and selects there, so it is
+ * O(S + log n); rank is the sizes of the shards below plus a local rank.
+ *
+ * When inserts make one shard more than twice the average (keys drifted
+ * from the sample), a background thread rebalances: under an exclusive
+ * lock it joins the shards into one tree, takes new splitters at the
+ * (i n / S)-th values, and splits the tree at them again, all with the
+ * O(log n) AVL join and split. Every other operation holds the layout lock
+ * shared. Updates lock their one shard exclusively; select and rank hold
+ * shared locks on every shard they sum, taken in index order, so the prefix
+ * sum and the local query see the same shards.
+ */
+class ShardedIndex
+{
+public:
+    ShardedIndex(int shardCount = 16)
+        : shardCount(max(shardCount, 1)), shards(new Shard[max(shardCount, 1)]), total(0), rebalancedAt(0),
+          rebalancePending(false), stopping(false)
+    {
+        // Evenly spaced over the int range until a sample or a rebalance says otherwise.
+        for (int s = 1; s < this->shardCount; s++)
+        {
+            splitters.push_back((int)(INT_MIN + (long long)s * ((long long)UINT_MAX / this->shardCount)));
+        }
+        rebalancer = thread([this]()
+                            { rebalanceLoop(); });
+    }
+
+    ~ShardedIndex()
+    {
+        {
+            lock_guard<mutex> guard(signalLock);
+            stopping = true;
+        }
+        signal.notify_one();
+        rebalancer.join();
+        for (int s = 0; s < shardCount; s++)
+        {
+            deleteTree(shards[s].root);
+        }
+    }
+
+    ShardedIndex(const ShardedIndex &) = delete;
+    ShardedIndex &operator=(const ShardedIndex &) = delete;
+
+    /**
+     * @brief Set the splitters to the quantiles of a sample of the keys
+     * expected; the values already stored are redistributed.
+     */
+    void configure(vector<int> sample)
+    {
+        if (sample.empty())
+        {
+            return;
+        }
+        sort(sample.begin(), sample.end());
+        vector<int> chosen;
+        for (int s = 1; s < shardCount; s++)
+        {
+            chosen.push_back(sample[(size_t)s * sample.size() / shardCount]);
+        }
+        unique_lock<shared_mutex> exclusive(layoutLock);
+        redistribute(&chosen);
+    }
+
+    void insert(int value)
+    {
+        shared_lock<shared_mutex> shared(layoutLock);
+        Shard &shard = shards[route(value)];
+        int size;
+        {
+            lock_guard<shared_mutex> guard(shard.lock);
+            shard.root = ::insert(shard.root, value);
+            size = ++shard.size;
+        }
+        int count = ++total;
+        // Wait for another shard's worth of inserts after a rebalance, so
+        // shards that cannot be split (one repeated key) do not retrigger it.
+        if (size > 2 * (count / shardCount) + SHARD_SLACK && count - rebalancedAt.load() > count / shardCount &&
+            !rebalancePending.exchange(true))
+        {
+            lock_guard<mutex> guard(signalLock);
+            signal.notify_one();
+        }
+    }
+
+    void erase(int value)
+    {
+        shared_lock<shared_mutex> shared(layoutLock);
+        Shard &shard = shards[route(value)];
+        lock_guard<shared_mutex> guard(shard.lock);
+        int before = subtreeSize(shard.root);
+        shard.root = ::erase(shard.root, value);
+        if (subtreeSize(shard.root) != before)
+        {
+            shard.size--;
+            total--;
+        }
+    }
+
+    bool select(int position, int &value) const
+    {
+        shared_lock<shared_mutex> shared(layoutLock);
+        int s = 0;
+        for (; s < shardCount; s++)
+        {
+            shards[s].lock.lock_shared();
+            int size = shards[s].size.load();
+            if (position <= size)
+            {
+                break;
+            }
+            position -= size;
+        }
+        Node *found = s < shardCount ? ::select(position, shards[s].root) : NULL;
+        if (found != NULL)
+        {
+            value = found->value;
+        }
+        unlockShards(min(s + 1, shardCount));
+        return found != NULL;
+    }
+
+    int getRank(int value) const { return countBelow(value, true); }
+    int countLess(int value) const { return countBelow(value, false); }
+    int countRange(int low, int high) const { return low > high ? 0 : getRank(high) - countLess(low); }
+    int size() const { return total.load(); }
+
+    /**
+     * @brief Rebalance now, on the calling thread.
+     */
+    void rebalance()
+    {
+        unique_lock<shared_mutex> exclusive(layoutLock);
+        redistribute(NULL);
+    }
+
+private:
+    struct Shard
+    {
+        Shard() : root(NULL), size(0) {}
+        mutable shared_mutex lock;
+        Node *root;
+        atomic<int> size;
+    };
+
+    int route(int value) const { return (int)(upper_bound(splitters.begin(), splitters.end(), value) - splitters.begin()); }
+
+    int countBelow(int value, bool inclusive) const
+    {
+        shared_lock<shared_mutex> shared(layoutLock);
+        int s = route(value);
+        int rank = 0;
+        for (int below = 0; below <= s; below++)
+        {
+            shards[below].lock.lock_shared();
+            rank += below < s ? shards[below].size.load() : 0;
+        }
+        rank += inclusive ? ::getRank(value, shards[s].root) : ::countLess(value, shards[s].root);
+        unlockShards(s + 1);
+        return rank;
+    }
+
+    // Releases the shared locks select() and countBelow() took on the first count shards.
+    void unlockShards(int count) const
+    {
+        for (int s = 0; s < count; s++)
+        {
+            shards[s].lock.unlock_shared();
+        }
+    }
+
+    // Rebuilds the shards around the given splitters, or around evenly
+    // spaced ranks when there are none. The layout lock must be held exclusively.
+    void redistribute(const vector<int> *chosen)
+    {
+        Node *all = NULL;
+        for (int s = 0; s < shardCount; s++)
+        {
+            all = join2(all, shards[s].root);
+        }
+        int n = subtreeSize(all);
+        if (chosen != NULL)
+        {
+            splitters = *chosen;
+        }
+        else if (n > 0)
+        {
+            for (int s = 1; s < shardCount; s++)
+            {
+                splitters[s - 1] = ::select((int)((long long)s * n / shardCount) + 1, all)->value;
+            }
+        }
+
+        for (int s = 0; s + 1 < shardCount; s++)
+        {
+            Node *less, *greater;
+            Node *mid = split(all, splitters[s], less, greater);
+            shards[s].root = less;
+            shards[s].size = subtreeSize(less);
+            all = mid != NULL ? join(NULL, mid, greater) : greater;
+        }
+        shards[shardCount - 1].root = all;
+        shards[shardCount - 1].size = subtreeSize(all);
+        rebalancedAt = n;
+    }
+
+    void rebalanceLoop()
+    {
+        while (true)
+        {
+            {
+                unique_lock<mutex> guard(signalLock);
+                signal.wait(guard, [this]()
+                            { return rebalancePending.load() || stopping; });
+                if (stopping)
+                {
+                    return;
+                }
+            }
+            rebalance();
+            rebalancePending = false;
+        }
+    }
+
+    int shardCount;
+    unique_ptr<Shard[]> shards;
+    vector<int> splitters;
+    mutable shared_mutex layoutLock;
+    atomic<int> total;
+    // The size at the last rebalance.
+    atomic<int> rebalancedAt;
+
+    thread rebalancer;
+    mutex signalLock;
+    condition_variable signal;
+    atomic<bool> rebalancePending;
+    bool stopping;
+};
+
+#endif
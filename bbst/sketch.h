@@ -0,0 +1,194 @@
+/**
+ * @file sketch.h
+ * @brief KLL quantile sketch.
+ */
+
+#ifndef BBST_SKETCH_H
+#define BBST_SKETCH_H
+
+#include "common.h"
+
+/**
+ * @brief Approximate quantiles in O(1/epsilon) memory: a KLL sketch
+ * (Karnin, Lang and Liberty).
+ *
+ * Samples enter level 0. Every item on level h stands for 2^h samples. When
+ * a level outgrows its capacity it is sorted and every other item (starting
+ * at a random one of the first two) is promoted to the next level, the rest
+ * are dropped. Lower levels get geometrically smaller capacities (2/3 per
+ * level below the top), so the sketch keeps O(k) items in all, and with
+ * k = 1.65 / epsilon the rank of any answer is off by at most about
+ * epsilon * n with high probability.
+ *
+ * Two sketches built over different samples merge into a sketch of the
+ * union with the same guarantee, so shards or threads can each keep one.
+ * There is no erase.
+ */
+class KLLSketch
+{
+public:
+    KLLSketch(double epsilon = 0.01) : k(max(8, (int)ceil(1.65 / epsilon))), count(0), retained(0), generator(7)
+    {
+        resizeLevels(1);
+    }
+
+    void insert(int value)
+    {
+        levels[0].push_back(value);
+        count++;
+        retained++;
+        if (retained > totalCapacity)
+        {
+            compress();
+        }
+    }
+
+    /**
+     * @brief Fold another sketch into this one.
+     */
+    void merge(const KLLSketch &other)
+    {
+        if (other.levels.size() > levels.size())
+        {
+            resizeLevels(other.levels.size());
+        }
+        for (size_t h = 0; h < other.levels.size(); h++)
+        {
+            levels[h].insert(levels[h].end(), other.levels[h].begin(), other.levels[h].end());
+        }
+        count += other.count;
+        retained += other.retained;
+        while (retained > totalCapacity)
+        {
+            compress();
+        }
+    }
+
+    /**
+     * @brief Approximately the position-th smallest sample.
+     *
+     * @param position 1-based, at most size().
+     * @param value Receives the value.
+     * @return bool False when the position is out of range.
+     */
+    bool select(long long position, int &value) const
+    {
+        if (position < 1 || position > count)
+        {
+            return false;
+        }
+        // Walk the retained items in order, each standing for 2^level samples.
+        vector<pair<int, long long>> items = weightedItems();
+        long long seen = 0;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            seen += items[i].second;
+            if (seen >= position)
+            {
+                value = items[i].first;
+                return true;
+            }
+        }
+        value = items.back().first;
+        return true;
+    }
+
+    /**
+     * @brief Approximately the number of samples <= value.
+     */
+    long long getRank(int value) const
+    {
+        long long rank = 0;
+        for (size_t h = 0; h < levels.size(); h++)
+        {
+            for (size_t i = 0; i < levels[h].size(); i++)
+            {
+                if (levels[h][i] <= value)
+                {
+                    rank += 1LL << h;
+                }
+            }
+        }
+        return rank;
+    }
+
+    long long size() const { return count; }
+
+    // The number of items kept, the sketch's memory footprint.
+    int itemsRetained() const { return retained; }
+
+private:
+    // Adds levels, recomputing the capacities: they depend on the depth below the top.
+    void resizeLevels(size_t levelCount)
+    {
+        levels.resize(levelCount);
+        capacities.resize(levelCount);
+        totalCapacity = 0;
+        for (size_t h = 0; h < levelCount; h++)
+        {
+            capacities[h] = max(2, (int)ceil(k * pow(2.0 / 3.0, (double)(levelCount - 1 - h))));
+            totalCapacity += capacities[h];
+        }
+    }
+
+    // Compacts the lowest level that is over its capacity, adding a level on top if needed.
+    void compress()
+    {
+        for (size_t h = 0; h < levels.size(); h++)
+        {
+            if ((int)levels[h].size() < capacities[h])
+            {
+                continue;
+            }
+            if (h + 1 == levels.size())
+            {
+                resizeLevels(levels.size() + 1);
+            }
+
+            vector<int> &level = levels[h];
+            sort(level.begin(), level.end());
+            // An odd item out stays behind, so the total weight is preserved.
+            bool odd = level.size() % 2 == 1;
+            int leftover = odd ? level.back() : 0;
+            if (odd)
+            {
+                level.pop_back();
+            }
+            for (size_t i = generator() & 1; i < level.size(); i += 2)
+            {
+                levels[h + 1].push_back(level[i]);
+            }
+            retained -= (int)level.size() / 2;
+            level.clear();
+            if (odd)
+            {
+                level.push_back(leftover);
+            }
+            return;
+        }
+    }
+
+    vector<pair<int, long long>> weightedItems() const
+    {
+        vector<pair<int, long long>> items;
+        items.reserve(retained);
+        for (size_t h = 0; h < levels.size(); h++)
+        {
+            for (size_t i = 0; i < levels[h].size(); i++)
+            {
+                items.push_back(make_pair(levels[h][i], 1LL << h));
+            }
+        }
+        sort(items.begin(), items.end());
+        return items;
+    }
+
+    int k;
+    long long count;
+    int retained, totalCapacity;
+    vector<vector<int>> levels;
+    vector<int> capacities;
+    mt19937 generator;
+};
+
+#endif
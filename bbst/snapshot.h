@@ -0,0 +1,393 @@
+/**
+ * @file snapshot.h
+ * @brief Snapshot files and the memory-mapped read-only tree.
+ */
+
+#ifndef BBST_SNAPSHOT_H
+#define BBST_SNAPSHOT_H
+
+#include "common.h"
+#include "avl.h"
+
+/**
+ * @brief Snapshot file layout: a header followed by every node of the tree in
+ * post-order, children before their parent, so the root is the last node.
+ * Children are referred to by index (-1 for none) rather than by pointer, so
+ * the image can be mapped at any address and queried without rebuilding.
+ * All fields are in the byte order of the machine that wrote the file.
+ * The header records the tree's height so readers can bound every walk.
+ */
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeSize;
+    int64_t nodeCount;
+    int64_t valueCount;
+    int32_t height;
+    int32_t reserved;
+};
+
+struct SnapshotNode
+{
+    int32_t value;
+    int32_t count;
+    int32_t left, right;
+    int32_t numLeftChildren;
+};
+
+const char SNAPSHOT_MAGIC[8] = {'B', 'B', 'S', 'T', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOT_VERSION = 2;
+
+/**
+ * @brief Appends a subtree to the snapshot in post-order.
+ *
+ * @param node The root of the subtree.
+ * @param buffer Nodes waiting to be written; flushed to the file when full.
+ * @param file The snapshot being written.
+ * @param written The number of nodes emitted so far, which is the next index.
+ * @return int32_t The index of the subtree's root, or -1 for an empty subtree.
+ */
+inline int32_t writeSnapshotNodes(Node *node, vector<SnapshotNode> &buffer, FILE *file, int64_t &written)
+{
+    if (node == NULL)
+    {
+        return -1;
+    }
+    SnapshotNode flat;
+    flat.left = writeSnapshotNodes(node->left, buffer, file, written);
+    flat.right = writeSnapshotNodes(node->right, buffer, file, written);
+    flat.value = node->value;
+    flat.count = node->count;
+    flat.numLeftChildren = node->numLeftChildren;
+
+    buffer.push_back(flat);
+    if (buffer.size() == buffer.capacity())
+    {
+        fwrite(buffer.data(), sizeof(SnapshotNode), buffer.size(), file);
+        buffer.clear();
+    }
+    return (int32_t)written++;
+}
+
+/**
+ * @brief Writes a tree to a snapshot file that MappedTree can open.
+ *
+ * @param root The root of the tree.
+ * @param path The file to create or overwrite.
+ * @return bool False when the file cannot be written.
+ */
+inline bool saveSnapshot(Node *root, const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.nodeSize = sizeof(SnapshotNode);
+    header.nodeCount = countNodes(root);
+    header.valueCount = subtreeSize(root);
+    header.height = height(root);
+    fwrite(&header, sizeof(header), 1, file);
+
+    vector<SnapshotNode> buffer;
+    buffer.reserve(1 << 16);
+    int64_t written = 0;
+    writeSnapshotNodes(root, buffer, file, written);
+    fwrite(buffer.data(), sizeof(SnapshotNode), buffer.size(), file);
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+/**
+ * @brief A read-only tree served straight from a memory-mapped snapshot.
+ *
+ * Opening maps the file and checks only its header, so it costs the same
+ * at any size. Nothing is parsed or rebuilt, and queries are the same walks
+ * as on the AVL tree, following child indexes instead of pointers. Every
+ * walk only follows a child index below its parent's (the post-order
+ * layout) and stops after the recorded height, so a corrupt image gives
+ * wrong answers but never crashes or loops; verify() checks every node when
+ * the file is not trusted.
+ */
+class MappedTree
+{
+public:
+    MappedTree() : image(NULL), length(0), nodes(NULL), root(-1), values(0), levels(0) {}
+    ~MappedTree() { close(); }
+    MappedTree(const MappedTree &) = delete;
+    MappedTree &operator=(const MappedTree &) = delete;
+
+    /**
+     * @brief Map a snapshot written by saveSnapshot().
+     *
+     * @param path The snapshot file.
+     * @return bool False when the file is missing, not a snapshot, or its
+     * size or header is inconsistent. The nodes themselves are not read.
+     */
+    bool open(const char *path)
+    {
+        close();
+        int descriptor = ::open(path, O_RDONLY);
+        if (descriptor < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) != 0 || info.st_size < (off_t)sizeof(SnapshotHeader))
+        {
+            ::close(descriptor);
+            return false;
+        }
+        void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+        ::close(descriptor);
+        if (mapped == MAP_FAILED)
+        {
+            return false;
+        }
+        image = mapped;
+        length = info.st_size;
+
+        const SnapshotHeader *header = (const SnapshotHeader *)image;
+        if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != SNAPSHOT_VERSION || header->nodeSize != sizeof(SnapshotNode) ||
+            header->nodeCount < 0 || header->nodeCount > INT32_MAX ||
+            (size_t)header->nodeCount != (length - sizeof(SnapshotHeader)) / sizeof(SnapshotNode) ||
+            (length - sizeof(SnapshotHeader)) % sizeof(SnapshotNode) != 0 || header->valueCount < 0 ||
+            header->valueCount > INT_MAX || (header->nodeCount == 0) != (header->valueCount == 0) ||
+            header->height < 0 || header->height > header->nodeCount ||
+            (header->nodeCount > 0) != (header->height > 0))
+        {
+            close();
+            return false;
+        }
+        nodes = (const SnapshotNode *)((const char *)image + sizeof(SnapshotHeader));
+        root = (int32_t)(header->nodeCount - 1);
+        values = (int)header->valueCount;
+        levels = header->height;
+        // Queries jump around the image, so read-ahead would only waste I/O.
+        madvise(image, length, MADV_RANDOM);
+        return true;
+    }
+
+    void close()
+    {
+        if (image != NULL)
+        {
+            munmap(image, length);
+        }
+        image = NULL;
+        nodes = NULL;
+        root = -1;
+        values = 0;
+        levels = 0;
+    }
+
+    /**
+     * @brief Check every node of the mapped image, in one O(nodes) pass: every
+     * child index is below its parent's and used once, every count is
+     * positive, each numLeftChildren is the size of the left subtree, and the
+     * root's size and height match the header.
+     *
+     * @return bool False when the image is not a valid tree.
+     */
+    bool verify() const
+    {
+        int64_t nodeCount = (int64_t)root + 1;
+        vector<int64_t> sizes(nodeCount);
+        vector<int32_t> heights(nodeCount);
+        vector<bool> used(nodeCount, false);
+        auto child = [&](int32_t index, int64_t parent, int64_t &size, int32_t &depth)
+        {
+            if (index == -1)
+            {
+                size = 0;
+                depth = 0;
+                return true;
+            }
+            if (index < 0 || index >= parent || used[index])
+            {
+                return false;
+            }
+            used[index] = true;
+            size = sizes[index];
+            depth = heights[index];
+            return true;
+        };
+        for (int64_t i = 0; i < nodeCount; i++)
+        {
+            const SnapshotNode &node = nodes[i];
+            int64_t leftSize, rightSize;
+            int32_t leftHeight, rightHeight;
+            if (!child(node.left, i, leftSize, leftHeight) || !child(node.right, i, rightSize, rightHeight) ||
+                node.count < 1 || node.numLeftChildren != leftSize)
+            {
+                return false;
+            }
+            sizes[i] = leftSize + node.count + rightSize;
+            heights[i] = max(leftHeight, rightHeight) + 1;
+            if (sizes[i] > INT_MAX)
+            {
+                return false;
+            }
+        }
+        return nodeCount == 0 || (sizes[root] == values && heights[root] == levels);
+    }
+
+    bool select(int position, int &value) const
+    {
+        if (position < 1 || position > values)
+        {
+            return false;
+        }
+        long long remaining = position;
+        int32_t index = root;
+        for (int depth = 0; index >= 0 && depth < levels; depth++)
+        {
+            const SnapshotNode &node = nodes[index];
+            if (remaining <= node.numLeftChildren)
+            {
+                index = child(index, node.left);
+            }
+            else if (remaining > (long long)node.numLeftChildren + node.count)
+            {
+                remaining -= (long long)node.numLeftChildren + node.count;
+                index = child(index, node.right);
+            }
+            else
+            {
+                value = node.value;
+                return true;
+            }
+        }
+        // Only reached on a corrupt image.
+        return false;
+    }
+
+    int getRank(int value) const
+    {
+        long long rank = 0;
+        int32_t index = root;
+        for (int depth = 0; index >= 0 && depth < levels; depth++)
+        {
+            const SnapshotNode &node = nodes[index];
+            if (value < node.value)
+            {
+                index = child(index, node.left);
+            }
+            else
+            {
+                rank += (long long)node.numLeftChildren + node.count;
+                index = child(index, node.right);
+            }
+        }
+        return (int)rank;
+    }
+
+    int countLess(int value) const
+    {
+        long long rank = 0;
+        int32_t index = root;
+        for (int depth = 0; index >= 0 && depth < levels; depth++)
+        {
+            const SnapshotNode &node = nodes[index];
+            if (value <= node.value)
+            {
+                index = child(index, node.left);
+            }
+            else
+            {
+                rank += (long long)node.numLeftChildren + node.count;
+                index = child(index, node.right);
+            }
+        }
+        return (int)rank;
+    }
+
+    /**
+     * @brief select() for many positions, with the descents interleaved and
+     * prefetched as in ::selectBatch(); page faults on a cold image overlap too.
+     *
+     * @param positions The positions to select.
+     * @param count The number of positions.
+     * @param results Receives the selected values.
+     * @param found Receives false for positions out of range.
+     */
+    void selectBatch(const int *positions, int count, int *results, bool *found) const
+    {
+        for (int base = 0; base < count; base += SELECT_GROUP)
+        {
+            int group = min(SELECT_GROUP, count - base);
+            int32_t cursor[SELECT_GROUP];
+            long long remaining[SELECT_GROUP];
+            int active = 0;
+            for (int i = 0; i < group; i++)
+            {
+                remaining[i] = positions[base + i];
+                bool valid = remaining[i] >= 1 && remaining[i] <= values;
+                cursor[i] = valid ? root : -1;
+                found[base + i] = false;
+                active += valid;
+            }
+
+            for (int depth = 0; active > 0 && depth < levels; depth++)
+            {
+                for (int i = 0; i < group; i++)
+                {
+                    if (cursor[i] < 0)
+                    {
+                        continue;
+                    }
+                    const SnapshotNode &node = nodes[cursor[i]];
+                    if (remaining[i] > (long long)node.numLeftChildren + node.count)
+                    {
+                        remaining[i] -= (long long)node.numLeftChildren + node.count;
+                        cursor[i] = child(cursor[i], node.right);
+                    }
+                    else if (remaining[i] <= node.numLeftChildren)
+                    {
+                        cursor[i] = child(cursor[i], node.left);
+                    }
+                    else
+                    {
+                        results[base + i] = node.value;
+                        found[base + i] = true;
+                        cursor[i] = -1;
+                        active--;
+                        continue;
+                    }
+                    if (cursor[i] < 0)
+                    {
+                        // Fell off a corrupt image.
+                        active--;
+                        continue;
+                    }
+                    prefetchNode(&nodes[cursor[i]]);
+                }
+            }
+        }
+    }
+
+    int countRange(int low, int high) const { return low > high ? 0 : getRank(high) - countLess(low); }
+    int size() const { return values; }
+
+private:
+    // A child index as a walk may follow it: below its parent's, as in the
+    // post-order layout, or -1 (also returned for any other index).
+    static int32_t child(int32_t parent, int32_t index) { return index >= 0 && index < parent ? index : -1; }
+
+    void *image;
+    size_t length;
+    const SnapshotNode *nodes;
+    int32_t root;
+    int values;
+    int levels;
+};
+
+#endif
@@ -0,0 +1,94 @@
+/**
+ * @file stats.h
+ * @brief Opt-in instrumentation counters (BBST_STATS).
+ */
+
+#ifndef BBST_STATS_H
+#define BBST_STATS_H
+
+#include "common.h"
+
+/*
+ * Instrumentation. Build with -DBBST_STATS to count AVL rotations by type,
+ * the nodes each insert passes and the rotations it makes, the depth of
+ * every select descent, and node allocations; treeStatsJson() dumps them
+ * with the shape of a tree. Without the flag every BBST_STAT() hook
+ * expands to nothing and none of the counters exist.
+ */
+#ifdef BBST_STATS
+
+/**
+ * @brief Histogram buckets; longer paths are counted in the last one.
+ */
+const int STATS_BUCKETS = 64;
+
+/**
+ * @brief Process-wide counters, updated with relaxed atomics so trees used
+ * from several threads (sharded, parallel joins) can be counted too.
+ */
+struct TreeStats
+{
+    atomic<unsigned long long> leftRotations, rightRotations;
+    // Rebalancing cases, each one or two of the rotations above.
+    atomic<unsigned long long> leftLeft, rightRight, leftRight, rightLeft;
+    atomic<unsigned long long> inserts, nodesAllocated;
+    atomic<unsigned long long> rotationsPerInsert[3];
+    atomic<unsigned long long> insertPath[STATS_BUCKETS];
+    atomic<unsigned long long> selects;
+    atomic<unsigned long long> selectDepth[STATS_BUCKETS];
+};
+
+// Static storage: every counter starts at zero.
+inline TreeStats treeStats;
+
+inline void statsAdd(atomic<unsigned long long> &counter)
+{
+    counter.fetch_add(1, memory_order_relaxed);
+}
+
+inline void statsRecord(atomic<unsigned long long> *histogram, int value)
+{
+    statsAdd(histogram[min(value, STATS_BUCKETS - 1)]);
+}
+
+inline thread_local int insertDepth = 0;
+inline thread_local int insertPathLength = 0;
+inline thread_local unsigned long long threadRotations = 0;
+
+/**
+ * @brief Lives in every frame of the recursive insert(); the outermost one
+ * records the path length and rotations of the whole insert.
+ */
+class InsertProbe
+{
+public:
+    InsertProbe(const void *node)
+    {
+        if (insertDepth++ == 0)
+        {
+            insertPathLength = 0;
+            rotationsBefore = threadRotations;
+        }
+        insertPathLength += node != NULL;
+    }
+
+    ~InsertProbe()
+    {
+        if (--insertDepth == 0)
+        {
+            statsAdd(treeStats.inserts);
+            statsRecord(treeStats.insertPath, insertPathLength);
+            statsAdd(treeStats.rotationsPerInsert[min(threadRotations - rotationsBefore, 2ULL)]);
+        }
+    }
+
+private:
+    unsigned long long rotationsBefore = 0;
+};
+
+#define BBST_STAT(statement) statement
+#else
+#define BBST_STAT(statement)
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+/**
+ * @file window.h
+ * @brief Nearest-rank percentiles and the sliding-window index.
+ */
+
+#ifndef BBST_WINDOW_H
+#define BBST_WINDOW_H
+
+#include "common.h"
+#include "avl.h"
+
+/**
+ * @brief The nearest-rank position of a percentile: the p-th percentile of n
+ * values is the ceil(p / 100 * n)-th smallest, and the smallest for p = 0.
+ *
+ * @param percentile In [0, 100].
+ * @param n The number of values, at least 1.
+ * @return long long The 1-based position.
+ */
+inline long long nearestRank(double percentile, long long n)
+{
+    long long position = (long long)ceil(percentile / 100.0 * n);
+    return min(max(position, 1LL), n);
+}
+
+/**
+ * @brief Rolling percentiles over the last N samples of a stream.
+ *
+ * The window is a ring buffer of the samples in arrival order next to an AVL
+ * tree of the same samples. Each push() erases the expiring sample and
+ * inserts the new one, O(log N) for the pair instead of rebuilding a tree
+ * per window:
+ * - the node the erase unlinks is recycled for the insert, so a full window
+ *   slides without touching the allocator;
+ * - a sample equal to the one it replaces leaves the tree untouched.
+ * Percentiles use the nearest-rank definition (see nearestRank()).
+ */
+class SlidingWindow
+{
+public:
+    SlidingWindow(int capacity) : samples(capacity), head(0), filled(0), root(NULL), spare(NULL) {}
+    ~SlidingWindow()
+    {
+        deleteTree(root);
+        delete spare;
+    }
+    SlidingWindow(const SlidingWindow &) = delete;
+    SlidingWindow &operator=(const SlidingWindow &) = delete;
+
+    /**
+     * @brief Add a sample, expiring the oldest one once the window is full.
+     */
+    void push(int value)
+    {
+        if (filled < (int)samples.size())
+        {
+            filled++;
+        }
+        else
+        {
+            int expired = samples[head];
+            if (expired == value)
+            {
+                head = head + 1 == (int)samples.size() ? 0 : head + 1;
+                return;
+            }
+            root = ::erase(root, expired, &spare);
+        }
+        samples[head] = value;
+        head = head + 1 == (int)samples.size() ? 0 : head + 1;
+        root = ::insert(root, value, &spare);
+    }
+
+    /**
+     * @brief The nearest-rank percentile of the samples in the window.
+     *
+     * @param percentile In [0, 100].
+     * @param value Receives the sample.
+     * @return bool False while the window is empty.
+     */
+    bool percentile(double percentile, int &value) const
+    {
+        if (filled == 0)
+        {
+            return false;
+        }
+        Node *found = ::select((int)nearestRank(percentile, filled), root);
+        value = found->value;
+        return true;
+    }
+
+    int size() const { return filled; }
+
+private:
+    vector<int> samples;
+    int head, filled;
+    Node *root;
+    // A node unlinked by the last erase, waiting to be reused.
+    Node *spare;
+};
+
+#endif